@@ -0,0 +1,124 @@
+#include "admit.h"
+
+//tinylfu: a count-min sketch of recent accesses behind a doorkeeper bloom filter
+static uint8_t *admit_table;
+static uint64_t *admit_door;
+static uint32_t admit_mask;
+static uint32_t admit_door_mask;
+static uint64_t admit_nadd;
+static uint64_t admit_window;
+static uint64_t admit_rejected;
+
+rstatus_t admit_init(size_t nitem) {
+    size_t width = ADMIT_MIN_WIDTH;
+    while (width < nitem && width < ((size_t)1 << 31)) {
+        width <<= 1;
+    }
+    free(admit_table);
+    free(admit_door);
+    admit_table = calloc(width, ADMIT_DEPTH);
+    //two bits a key, a doorkeeper of four bits per counter keeps false positives low
+    admit_door = calloc(width * 4 / 64, sizeof(*admit_door));
+    if (admit_table == NULL || admit_door == NULL) {
+        return MC_ENOMEM;
+    }
+    admit_mask = (uint32_t)(width - 1);
+    admit_door_mask = (uint32_t)(width * 4 - 1);
+    admit_nadd = 0;
+    admit_window = (uint64_t)width * ADMIT_SAMPLE_FACTOR;
+    admit_rejected = 0;
+    return MC_OK;
+}
+
+//double hashing over a remix of hv, whose high bits already picked the shard
+static void admit_hash(uint32_t hv, uint32_t *h1, uint32_t *h2) {
+    uint64_t h = (uint64_t)hv * 0x9e3779b97f4a7c15ULL;
+    *h1 = (uint32_t)(h >> 32);
+    *h2 = (uint32_t)h | 1;
+}
+
+static bool admit_door_test(uint32_t h1, uint32_t h2) {
+    uint32_t a = h1 & admit_door_mask, b = h2 & admit_door_mask;
+    return (__atomic_load_n(&admit_door[a >> 6], __ATOMIC_RELAXED) & (1ULL << (a & 63))) &&
+        (__atomic_load_n(&admit_door[b >> 6], __ATOMIC_RELAXED) & (1ULL << (b & 63)));
+}
+
+static void admit_door_set(uint32_t h1, uint32_t h2) {
+    uint32_t a = h1 & admit_door_mask, b = h2 & admit_door_mask;
+    __atomic_fetch_or(&admit_door[a >> 6], 1ULL << (a & 63), __ATOMIC_RELAXED);
+    __atomic_fetch_or(&admit_door[b >> 6], 1ULL << (b & 63), __ATOMIC_RELAXED);
+}
+
+static uint8_t *admit_counter(uint32_t h1, uint32_t h2, uint32_t row) {
+    return &admit_table[(size_t)row * (admit_mask + 1) + ((h1 + row * h2) & admit_mask)];
+}
+
+//halve every counter and empty the doorkeeper, so old popularity fades
+static void admit_age(void) {
+    size_t i, n = (size_t)(admit_mask + 1) * ADMIT_DEPTH;
+    for (i = 0; i < n; i++) {
+        __atomic_store_n(&admit_table[i], __atomic_load_n(&admit_table[i], __ATOMIC_RELAXED) >> 1, __ATOMIC_RELAXED);
+    }
+    n = (size_t)(admit_door_mask + 1) / 64;
+    for (i = 0; i < n; i++) {
+        __atomic_store_n(&admit_door[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+//counters race without locks, a lost increment only blurs an estimate
+void admit_record(uint32_t hv) {
+    uint32_t h1, h2, row;
+    uint8_t *c[ADMIT_DEPTH], v[ADMIT_DEPTH], min = ADMIT_COUNTER_MAX;
+    admit_hash(hv, &h1, &h2);
+    if (!admit_door_test(h1, h2)) {
+        admit_door_set(h1, h2);
+        return;
+    }
+    for (row = 0; row < ADMIT_DEPTH; row++) {
+        c[row] = admit_counter(h1, h2, row);
+        v[row] = __atomic_load_n(c[row], __ATOMIC_RELAXED);
+        if (v[row] < min) {
+            min = v[row];
+        }
+    }
+    if (min == ADMIT_COUNTER_MAX) {
+        return;
+    }
+    //conservative update, only the counters at the minimum grow
+    for (row = 0; row < ADMIT_DEPTH; row++) {
+        if (v[row] == min) {
+            __atomic_store_n(c[row], min + 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (__atomic_add_fetch(&admit_nadd, 1, __ATOMIC_RELAXED) == admit_window) {
+        admit_age();
+        __atomic_store_n(&admit_nadd, 0, __ATOMIC_RELAXED);
+    }
+}
+
+uint32_t admit_estimate(uint32_t hv) {
+    uint32_t h1, h2, row, min = ADMIT_COUNTER_MAX;
+    uint8_t c;
+    admit_hash(hv, &h1, &h2);
+    for (row = 0; row < ADMIT_DEPTH; row++) {
+        c = __atomic_load_n(admit_counter(h1, h2, row), __ATOMIC_RELAXED);
+        if (c < min) {
+            min = c;
+        }
+    }
+    return min + (admit_door_test(h1, h2) ? 1 : 0);
+}
+
+//a victim nobody asked for since the last aging is never worth keeping
+bool admit_allow(uint32_t hv, uint32_t vhv) {
+    uint32_t vfreq = admit_estimate(vhv);
+    if (vfreq == 0 || admit_estimate(hv) > vfreq) {
+        return true;
+    }
+    __atomic_add_fetch(&admit_rejected, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+uint64_t admit_nreject(void) {
+    return __atomic_load_n(&admit_rejected, __ATOMIC_RELAXED);
+}
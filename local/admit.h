@@ -0,0 +1,21 @@
+#ifndef LOCAL_ADMIT_H_
+#define LOCAL_ADMIT_H_
+#include "cache.h"
+
+//rows of the count-min sketch, one counter per row for each key
+#define ADMIT_DEPTH 4
+#define ADMIT_COUNTER_MAX 15
+#define ADMIT_MIN_WIDTH 1024
+//recorded accesses per counter of a row before every counter is halved
+#define ADMIT_SAMPLE_FACTOR 10
+
+rstatus_t admit_init(size_t nitem);
+//count one access to the key of hv, the first one only marks the doorkeeper
+void admit_record(uint32_t hv);
+//estimated accesses to the key of hv since the last aging
+uint32_t admit_estimate(uint32_t hv);
+//true if a put of hv may evict the item of vhv
+bool admit_allow(uint32_t hv, uint32_t vhv);
+uint64_t admit_nreject(void);
+
+#endif
@@ -1,69 +1,432 @@
-#include "hash.h"
 #include "item.h"
 #include "assoc.h"
+#include "shard.h"
+#include "epoch.h"
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define HASHSIZE(_n) (1UL << (_n))
 #define HASHMASK(_n) (HASHSIZE(_n) - 1)
-#define HASH_DEFAULT_MOVE_SIZE 1
+//buckets moved between two looks at the clock
+#define HASH_MIGRATE_BATCH 32
+//longest the maintenance thread holds a shard lock while migrating
+#define HASH_MIGRATE_BUDGET_NS 50000
+//rest between two rounds over the shards, so a migration takes a fraction of a core
+#define HASH_MIGRATE_PAUSE_NS 200000
+//buckets an insert or delete moves along the way
+#define HASH_HELP_SIZE 2
+#ifdef ASSOC_BUCKET
+//same table footprint as the chained default
+#define HASH_DEFAULT_POWER 13
+#define HASH_LOAD_FACTOR(_n) (HASHSIZE(_n) * ASSOC_BUCKET_SLOTS * 3 / 4)
+#else
 #define HASH_DEFAULT_POWER 16
+#define HASH_LOAD_FACTOR(_n) (HASHSIZE(_n) * 3 / 2)
+#endif
+//shrink well below the grow point so sizes do not flap
+#define HASH_SHRINK_FACTOR(_n) (HASH_LOAD_FACTOR(_n) / 8)
 
 extern struct settings settings;
-extern pthread_mutex_t cache_lock;
-//primary hash table
-static struct item_slh *primary_hashtable;
-//older hash table
-static struct item_slh *old_hashtable;
-//hash item size
-static uint32_t nhash_item;
-//hash power
-static uint32_t hash_power;
-//expanding flag
-static int expanding;
-//size to move per transfer
-static uint32_t nhash_move_size;
-//size transfered
-static uint32_t expand_bucket;
+//power the tables start at and never shrink below
+static uint32_t hash_min_power;
+//number of shards with a resize in progress
+static uint32_t nexpanding;
 //maintenance thread related
+static pthread_mutex_t maintenance_lock;
 static pthread_cond_t maintenance_cond;
 static pthread_t maintenance_tid;
 //maintenance thread switch
 static volatile int run_maintenance_thread;
 
-static struct item_slh *assoc_create_table(uint32_t table_sz) {
-    struct item_slh *table = NULL;
+//lock free readers retry a miss if the seq moved while they looked
+static void assoc_write_begin(struct assoc *a) {
+    __atomic_store_n(&a->seq, a->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void assoc_write_end(struct assoc *a) {
+    __atomic_store_n(&a->seq, a->seq + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef ASSOC_BUCKET
+
+//buckets are cache line aligned
+static struct assoc_bucket *assoc_bucket_alloc(uint32_t n) {
+    void *p;
+    if (posix_memalign(&p, sizeof(struct assoc_bucket), sizeof(struct assoc_bucket) * n) != 0) return NULL;
+    memset(p, 0, sizeof(struct assoc_bucket) * n);
+    return p;
+}
+
+static struct assoc_bucket *assoc_create_table(uint32_t table_sz) {
+    return assoc_bucket_alloc(table_sz);
+}
+
+static void assoc_free_chain(struct assoc_bucket *b) {
+    struct assoc_bucket *next;
+    for (; b != NULL; b = next) {
+        next = b->next;
+        free(b);
+    }
+}
+
+static void assoc_free_table(struct assoc_bucket *table, uint32_t table_sz) {
+    uint32_t i;
+    for (i = 0; i < table_sz; i++) {
+        assoc_free_chain(table[i].next);
+    }
+    free(table);
+}
+
+//tag 0 marks a free slot
+static uint8_t assoc_tag(uint32_t hv) {
+    uint8_t tag = (uint8_t)((hv * 0x9e3779b1U) >> 24);
+    return tag == 0 ? 1 : tag;
+}
+
+//bit i is set when slot i may hold the tag
+static uint32_t assoc_bucket_match(struct assoc_bucket *b, uint8_t tag) {
+#ifdef __SSE2__
+    __m128i tags = _mm_loadl_epi64((const __m128i *)b->tag);
+    __m128i eq = _mm_cmpeq_epi8(tags, _mm_set1_epi8((char)tag));
+    return (uint32_t)_mm_movemask_epi8(eq) & ((1U << ASSOC_BUCKET_SLOTS) - 1);
+#else
+    uint64_t tags, x;
+    uint32_t i, mask = 0;
+    memcpy(&tags, b->tag, sizeof(tags));
+    x = tags ^ (0x0101010101010101ULL * tag);
+    x = (x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL;
+    for (i = 0; i < ASSOC_BUCKET_SLOTS; i++) {
+        if (x & (0x80ULL << (i * 8))) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+static struct item *assoc_bucket_find(struct assoc_bucket *b, uint32_t hv, const char *key, size_t nkey) {
+    struct item *it;
+    uint32_t mask, i;
+    uint8_t tag = assoc_tag(hv);
+    for (; b != NULL; b = __atomic_load_n(&b->next, __ATOMIC_ACQUIRE)) {
+        for (mask = assoc_bucket_match(b, tag); mask != 0; mask &= mask - 1) {
+            i = __builtin_ctz(mask);
+            it = __atomic_load_n(&b->slot[i], __ATOMIC_ACQUIRE);
+            if (it != NULL && it->hv == hv && (nkey == it->nkey) && (memcmp(key, item_key(it), nkey) == 0)) {
+                return it;
+            }
+        }
+    }
+    return NULL;
+}
+
+//true if the item is in the bucket, comparing pointers only
+static bool assoc_bucket_has(struct assoc_bucket *b, uint32_t hv, struct item *it) {
+    uint32_t mask;
+    uint8_t tag = assoc_tag(hv);
+    for (; b != NULL; b = b->next) {
+        for (mask = assoc_bucket_match(b, tag); mask != 0; mask &= mask - 1) {
+            if (b->slot[__builtin_ctz(mask)] == it) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void assoc_bucket_prefetch(struct assoc_bucket *b, uint32_t hv) {
+    uint32_t mask;
+    for (mask = assoc_bucket_match(b, assoc_tag(hv)); mask != 0; mask &= mask - 1) {
+        __builtin_prefetch(b->slot[__builtin_ctz(mask)]);
+    }
+}
+
+static void assoc_bucket_push(struct assoc_bucket *b, uint32_t hv, struct item *it) {
+    struct assoc_bucket *last = NULL;
+    uint32_t i;
+    for (; b != NULL; last = b, b = b->next) {
+        for (i = 0; i < ASSOC_BUCKET_SLOTS; i++) {
+            if (b->tag[i] == 0) {
+                goto found;
+            }
+        }
+    }
+    b = assoc_bucket_alloc(1);
+    if (b == NULL) {
+        abort();
+    }
+    __atomic_store_n(&last->next, b, __ATOMIC_RELEASE);
+    i = 0;
+found:
+    __atomic_store_n(&b->slot[i], it, __ATOMIC_RELEASE);
+    __atomic_store_n(&b->tag[i], assoc_tag(hv), __ATOMIC_RELEASE);
+}
+
+//free the older retired batch once it is safe, then close the current one
+static void assoc_bucket_reclaim(struct assoc *a) {
+    if (a->retired_old != NULL && epoch_safe() > a->retired_epoch) {
+        assoc_free_chain(a->retired_old);
+        a->retired_old = NULL;
+    }
+    if (a->retired_old == NULL && a->retired != NULL) {
+        a->retired_old = a->retired;
+        a->retired = NULL;
+        a->retired_epoch = epoch_now();
+        epoch_advance();
+    }
+}
+
+static bool assoc_bucket_empty(struct assoc_bucket *b) {
+    uint64_t tags;
+    memcpy(&tags, b->tag, sizeof(tags));
+    return tags == 0;
+}
+
+//take an empty overflow bucket out of its chain, a reader still on it walks
+//the retired list, which has no tags, and retries its miss on the seq
+static void assoc_bucket_unlink(struct assoc *a, struct assoc_bucket *prev, struct assoc_bucket *b) {
+    assoc_write_begin(a);
+    __atomic_store_n(&prev->next, b->next, __ATOMIC_RELEASE);
+    if (settings.lockfree_read) {
+        __atomic_store_n(&b->next, a->retired, __ATOMIC_RELEASE);
+        a->retired = b;
+    }
+    assoc_write_end(a);
+    if (settings.lockfree_read) {
+        assoc_bucket_reclaim(a);
+    } else {
+        free(b);
+    }
+}
+
+static void assoc_bucket_remove(struct assoc *a, struct assoc_bucket *b, struct item *it) {
+    struct assoc_bucket *prev = NULL;
+    uint32_t mask, i;
+    uint8_t tag = assoc_tag(it->hv);
+    for (; b != NULL; prev = b, b = b->next) {
+        for (mask = assoc_bucket_match(b, tag); mask != 0; mask &= mask - 1) {
+            i = __builtin_ctz(mask);
+            if (b->slot[i] == it) {
+                __atomic_store_n(&b->tag[i], 0, __ATOMIC_RELEASE);
+                __atomic_store_n(&b->slot[i], NULL, __ATOMIC_RELEASE);
+                if (prev != NULL && assoc_bucket_empty(b)) {
+                    assoc_bucket_unlink(a, prev, b);
+                }
+                return;
+            }
+        }
+    }
+    assert(0);
+}
+
+static void assoc_bucket_migrate(struct assoc *a, struct assoc_bucket *old_bucket) {
+    struct assoc_bucket *b;
+    struct item *it;
+    uint32_t i;
+    for (b = old_bucket; b != NULL; b = b->next) {
+        for (i = 0; i < ASSOC_BUCKET_SLOTS; i++) {
+            if (b->tag[i] == 0) {
+                continue;
+            }
+            it = b->slot[i];
+            assoc_bucket_push(&a->primary_hashtable[it->hv & HASHMASK(a->hash_power)], it->hv, it);
+            b->tag[i] = 0;
+            b->slot[i] = NULL;
+        }
+    }
+}
+
+#else
+
+static struct assoc_bucket *assoc_create_table(uint32_t table_sz) {
+    struct assoc_bucket *table = NULL;
     uint32_t i;
     table = malloc(sizeof(*table) * table_sz);
     if (table == NULL) return NULL;
     for (i = 0; i < table_sz; i++) {
-        SLIST_INIT(&table[i]);
+        table[i].first = 0;
     }
     return table;
 }
 
+static void assoc_free_table(struct assoc_bucket *table, uint32_t table_sz) {
+    free(table);
+}
+
+static struct item *assoc_bucket_find(struct assoc_bucket *bucket, uint32_t hv, const char *key, size_t nkey) {
+    struct item *it;
+    uint32_t depth;
+    for (depth = 0, it = item_deref(__atomic_load_n(&bucket->first, __ATOMIC_ACQUIRE)); it != NULL;
+         depth++, it = item_deref(__atomic_load_n(&it->h_next, __ATOMIC_ACQUIRE))) {
+        if (it->hv == hv && (nkey == it->nkey) && (memcmp(key, item_key(it), nkey) == 0)) {
+            break;
+        }
+    }
+    return it;
+}
+
+//true if the item is in the bucket, comparing pointers only
+static bool assoc_bucket_has(struct assoc_bucket *bucket, uint32_t hv, struct item *item) {
+    struct item *it;
+    for (it = item_deref(bucket->first); it != NULL; it = item_deref(it->h_next)) {
+        if (it == item) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void assoc_bucket_prefetch(struct assoc_bucket *bucket, uint32_t hv) {
+    if (bucket->first != 0) {
+        __builtin_prefetch(item_deref(bucket->first));
+    }
+}
+
+static void assoc_bucket_push(struct assoc_bucket *bucket, uint32_t hv, struct item *it) {
+    it->h_next = bucket->first;
+    __atomic_store_n(&bucket->first, item_ref(it), __ATOMIC_RELEASE);
+}
+
+static void assoc_bucket_remove(struct assoc *a, struct assoc_bucket *bucket, struct item *item) {
+    struct item *it, *prev;
+    for (prev = NULL, it = item_deref(bucket->first); it != item; prev = it, it = item_deref(it->h_next)) {
+        assert(it != NULL);
+    }
+    //the unlinked item keeps its next ref for readers still on it
+    if (prev == NULL) {
+        __atomic_store_n(&bucket->first, it->h_next, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&prev->h_next, it->h_next, __ATOMIC_RELEASE);
+    }
+}
+
+static void assoc_bucket_migrate(struct assoc *a, struct assoc_bucket *old_bucket) {
+    struct item *it;
+    while ((it = item_deref(old_bucket->first)) != NULL) {
+        old_bucket->first = it->h_next;
+        assoc_bucket_push(&a->primary_hashtable[it->hv & HASHMASK(a->hash_power)], it->hv, it);
+    }
+}
+
+#endif
+
+static uint64_t assoc_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//move up to nbucket old buckets, the drained old table is parked for the maintenance thread
+static uint32_t assoc_migrate(struct assoc *a, uint32_t nbucket) {
+    uint32_t i;
+    for (i = 0; i < nbucket && a->expanding == 1; i++) {
+        assoc_write_begin(a);
+        assoc_bucket_migrate(a, &a->old_hashtable[a->expand_bucket]);
+        a->expand_bucket++;
+        if (a->expand_bucket == HASHSIZE(a->old_power)) {
+            a->expanding = 0;
+            a->drained_hashtable = a->old_hashtable;
+            a->drained_power = a->old_power;
+            a->old_hashtable = NULL;
+        }
+        assoc_write_end(a);
+    }
+    return i;
+}
+
+//migrate in batches until the time budget for this lock hold runs out
+static void assoc_migrate_bounded(struct assoc *a) {
+    uint64_t start = assoc_clock_ns();
+    while (assoc_migrate(a, HASH_MIGRATE_BATCH) == HASH_MIGRATE_BATCH) {
+        if (assoc_clock_ns() - start >= HASH_MIGRATE_BUDGET_NS) {
+            break;
+        }
+    }
+}
+
+static void assoc_request_resize(struct assoc *a, uint32_t power) {
+    a->resize_power = power;
+    pthread_mutex_lock(&maintenance_lock);
+    nexpanding++;
+    pthread_cond_signal(&maintenance_cond);
+    pthread_mutex_unlock(&maintenance_lock);
+}
+
+//swap in a table allocated outside the lock
+static void assoc_start_resize(struct assoc *a, struct assoc_bucket *table, uint32_t power) {
+    assert(a->resize_power == power && a->expanding == 0 && a->drained_hashtable == NULL);
+    assoc_write_begin(a);
+    a->old_hashtable = a->primary_hashtable;
+    a->old_power = a->hash_power;
+    a->primary_hashtable = table;
+    a->hash_power = power;
+    a->expanding = 1;
+    a->expand_bucket = 0;
+    a->resize_power = 0;
+    assoc_write_end(a);
+}
+
+//one step of resize work on a shard, returns true once the resize is over
+static bool assoc_maintain(struct shard *s) {
+    struct assoc *a = &s->assoc;
+    struct assoc_bucket *table, *drained;
+    uint32_t power, drained_power;
+    bool done = false;
+    pthread_mutex_lock(&s->lock);
+    power = a->resize_power;
+    if (power != 0) {
+        pthread_mutex_unlock(&s->lock);
+        table = assoc_create_table(HASHSIZE(power));
+        pthread_mutex_lock(&s->lock);
+        if (table != NULL) {
+            assoc_start_resize(a, table, power);
+        } else {
+            //out of memory, try again when the load next crosses a threshold
+            a->resize_power = 0;
+            done = true;
+        }
+    }
+    if (a->expanding == 1) {
+        assoc_migrate_bounded(a);
+    }
+    drained = a->drained_hashtable;
+    drained_power = a->drained_power;
+    a->drained_hashtable = NULL;
+    pthread_mutex_unlock(&s->lock);
+    if (drained != NULL) {
+        if (settings.lockfree_read) {
+            epoch_synchronize();
+        }
+        assoc_free_table(drained, HASHSIZE(drained_power));
+        done = true;
+    }
+    return done;
+}
+
 static void *assoc_maintenance_thread(void *arg) {
-    uint32_t i, hv;
-    struct item_slh *old_bucket, *new_bucket;
-    struct item *it, *next;
+    struct timespec ts = {0, HASH_MIGRATE_PAUSE_NS};
+    uint32_t i, ndone;
     while (run_maintenance_thread) {
-        pthread_mutex_lock(&cache_lock);
-        for (i = 0; i < nhash_move_size && expanding == 1; i++) {
-            old_bucket = &old_hashtable[expand_bucket];
-            SLIST_FOREACH_SAFE(it, old_bucket, h_sle, next) {
-                hv = hash(item_key(it), it->nkey, 0);
-                new_bucket = &primary_hashtable[hv & HASHMASK(hash_power)];
-                SLIST_REMOVE(old_bucket, it, item, h_sle);
-                SLIST_INSERT_HEAD(new_bucket, it, h_sle);
-            }
-            expand_bucket++;
-            if (expand_bucket == HASHSIZE(hash_power - 1)) {
-                expanding = 0;
-                free(old_hashtable);
+        pthread_mutex_lock(&maintenance_lock);
+        while (run_maintenance_thread && nexpanding == 0) {
+            pthread_cond_wait(&maintenance_cond, &maintenance_lock);
+        }
+        pthread_mutex_unlock(&maintenance_lock);
+        for (i = 0, ndone = 0; i < nshard; i++) {
+            if (assoc_maintain(&shards[i])) {
+                ndone++;
             }
         }
-        if (expanding == 0) {
-            pthread_cond_wait(&maintenance_cond, &cache_lock);
+        if (ndone > 0) {
+            pthread_mutex_lock(&maintenance_lock);
+            nexpanding -= ndone;
+            pthread_mutex_unlock(&maintenance_lock);
         }
-        pthread_mutex_unlock(&cache_lock);
+        //leave the shard locks to the workers in between batches
+        nanosleep(&ts, NULL);
     }
     return NULL;
 }
@@ -77,21 +440,44 @@ static rstatus_t assoc_start_maintenance_thread(void) {
     return MC_OK;
 }
 
-rstatus_t assoc_init(void) {
-    rstatus_t status;
+static rstatus_t assoc_table_init(struct assoc *a) {
     uint32_t hashtable_sz;
-    primary_hashtable = NULL;
-    hash_power = settings.hash_power > 0 ? settings.hash_power : HASH_DEFAULT_POWER;
-    old_hashtable = NULL;
-    nhash_move_size = HASH_DEFAULT_MOVE_SIZE;
-    nhash_item = 0;
-    expanding = 0;
-    expand_bucket = 0;
-    hashtable_sz = HASHSIZE(hash_power);
-    primary_hashtable = assoc_create_table(hashtable_sz);
-    if (primary_hashtable == NULL) {
+    a->primary_hashtable = NULL;
+    a->hash_power = hash_min_power;
+    a->old_hashtable = NULL;
+    a->old_power = 0;
+    a->resize_power = 0;
+    a->nhash_item = 0;
+    a->expanding = 0;
+    a->expand_bucket = 0;
+    a->drained_hashtable = NULL;
+    a->drained_power = 0;
+    a->seq = 0;
+#ifdef ASSOC_BUCKET
+    a->retired = NULL;
+    a->retired_old = NULL;
+    a->retired_epoch = 0;
+#endif
+    hashtable_sz = HASHSIZE(a->hash_power);
+    a->primary_hashtable = assoc_create_table(hashtable_sz);
+    if (a->primary_hashtable == NULL) {
         return MC_ENOMEM;
     }
+    return MC_OK;
+}
+
+rstatus_t assoc_init(void) {
+    rstatus_t status;
+    uint32_t i;
+    hash_min_power = settings.hash_power > 0 ? settings.hash_power : HASH_DEFAULT_POWER;
+    nexpanding = 0;
+    for (i = 0; i < nshard; i++) {
+        status = assoc_table_init(&shards[i].assoc);
+        if (status != MC_OK) {
+            return status;
+        }
+    }
+    pthread_mutex_init(&maintenance_lock, NULL);
     pthread_cond_init(&maintenance_cond, NULL);
     run_maintenance_thread = 1;
     status = assoc_start_maintenance_thread();
@@ -102,10 +488,10 @@ rstatus_t assoc_init(void) {
 }
 
 static void assoc_stop_maintenance_thread(void) {
-    pthread_mutex_lock(&cache_lock);
+    pthread_mutex_lock(&maintenance_lock);
     run_maintenance_thread = 0;
     pthread_cond_signal(&maintenance_cond);
-    pthread_mutex_unlock(&cache_lock);
+    pthread_mutex_unlock(&maintenance_lock);
     pthread_join(maintenance_tid, NULL);
 }
 
@@ -113,80 +499,130 @@ void assoc_deinit(void) {
     assoc_stop_maintenance_thread();
 }
 
-static struct item_slh *assoc_get_bucket(const char *key, size_t nkey) {
-    struct item_slh *bucket;
-    uint32_t hv, oldbucket, curbucket;
-    hv = hash(key, nkey, 0);
-    oldbucket = hv & HASHMASK(hash_power - 1);
-    curbucket = hv & HASHMASK(hash_power);
-    if ((expanding == 1) && oldbucket >= expand_bucket) {
-        bucket = &old_hashtable[oldbucket];
+//keys whose old bucket is not migrated yet still live in the older table
+static struct assoc_bucket *assoc_get_bucket(struct assoc *a, uint32_t hv) {
+    struct assoc_bucket *bucket;
+    uint32_t oldbucket, curbucket;
+    oldbucket = hv & HASHMASK(a->old_power);
+    curbucket = hv & HASHMASK(a->hash_power);
+    if ((a->expanding == 1) && oldbucket >= a->expand_bucket) {
+        bucket = &a->old_hashtable[oldbucket];
     } else {
-        bucket = &primary_hashtable[curbucket];
+        bucket = &a->primary_hashtable[curbucket];
     }
     return bucket;
 }
 
-struct item* assoc_find(const char *key, size_t nkey) {
-    struct item_slh *bucket;
-    struct item *it;
-    uint32_t depth;
-    assert(pthread_mutex_trylock(&cache_lock) != 0);
+struct item* assoc_find(struct shard *s, const char *key, size_t nkey, uint32_t hv) {
+    assert(shard_locked(s));
     assert(key != NULL && nkey != 0);
-    bucket = assoc_get_bucket(key, nkey);
-    for (depth = 0, it = SLIST_FIRST(bucket); it != NULL; depth++, it = SLIST_NEXT(it, h_sle)) {
-        if ((nkey == it->nkey) && (memcmp(key, item_key(it), nkey) == 0)) {
-            break;
+    return assoc_bucket_find(assoc_get_bucket(&s->assoc, hv), hv, key, nkey);
+}
+
+//whether a pointer that may be stale still names a linked item, never touching it otherwise
+bool assoc_contains(struct shard *s, struct item *it, uint32_t hv) {
+    assert(shard_locked(s));
+    return assoc_bucket_has(assoc_get_bucket(&s->assoc, hv), hv, it);
+}
+
+//bucket of hv from a consistent view of the tables, which the caller's epoch keeps alive
+static struct assoc_bucket *assoc_get_bucket_nolock(struct assoc *a, uint32_t hv, uint32_t *seqp) {
+    struct assoc_bucket *table;
+    uint32_t seq, bucket;
+    for (;;) {
+        while ((seq = __atomic_load_n(&a->seq, __ATOMIC_ACQUIRE)) & 1) {
+        }
+        bucket = hv & HASHMASK(__atomic_load_n(&a->old_power, __ATOMIC_RELAXED));
+        if (__atomic_load_n(&a->expanding, __ATOMIC_RELAXED) == 1 &&
+            bucket >= __atomic_load_n(&a->expand_bucket, __ATOMIC_RELAXED)) {
+            table = __atomic_load_n(&a->old_hashtable, __ATOMIC_RELAXED);
+        } else {
+            table = __atomic_load_n(&a->primary_hashtable, __ATOMIC_RELAXED);
+            bucket = hv & HASHMASK(__atomic_load_n(&a->hash_power, __ATOMIC_RELAXED));
+        }
+        //a table and a power from two different resizes may not even overlap
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&a->seq, __ATOMIC_RELAXED) == seq) {
+            *seqp = seq;
+            return &table[bucket];
         }
     }
-    return it;
 }
 
-static bool assoc_expand_needed(void) {
-    return ((settings.hash_power == 0) && (expanding == 0) && (nhash_item > (HASHSIZE(hash_power) * 3 / 2)));
+struct item* assoc_find_nolock(struct shard *s, const char *key, size_t nkey, uint32_t hv) {
+    struct assoc *a = &s->assoc;
+    struct item *it;
+    uint32_t seq;
+    assert(key != NULL && nkey != 0);
+    do {
+        it = assoc_bucket_find(assoc_get_bucket_nolock(a, hv, &seq), hv, key, nkey);
+        if (it != NULL) {
+            return it;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&a->seq, __ATOMIC_RELAXED) != seq);
+    return NULL;
+}
+
+//only a hint, nothing is dereferenced so it is safe without the lock
+void assoc_prefetch_bucket(struct shard *s, uint32_t hv) {
+    struct assoc *a = &s->assoc;
+    struct assoc_bucket *table;
+    uint32_t power;
+    table = __atomic_load_n(&a->primary_hashtable, __ATOMIC_RELAXED);
+    power = __atomic_load_n(&a->hash_power, __ATOMIC_RELAXED);
+    __builtin_prefetch(&table[hv & HASHMASK(power)]);
 }
 
-static void assoc_expand(void) {
-    uint32_t hashtable_sz = HASHSIZE(hash_power + 1);
-    old_hashtable = primary_hashtable;
-    primary_hashtable = assoc_create_table(hashtable_sz);
-    if (primary_hashtable == NULL) {
-        primary_hashtable = old_hashtable;
-        return;
-    }
-    hash_power++;
-    expanding = 1;
-    expand_bucket = 0;
-    pthread_cond_signal(&maintenance_cond);
+//reads the bucket, so the caller holds the lock
+void assoc_prefetch_item(struct shard *s, uint32_t hv) {
+    assoc_bucket_prefetch(assoc_get_bucket(&s->assoc, hv), hv);
+}
+
+//lock free flavour, the caller is in an epoch
+void assoc_prefetch_item_nolock(struct shard *s, uint32_t hv) {
+    uint32_t seq;
+    assoc_bucket_prefetch(assoc_get_bucket_nolock(&s->assoc, hv, &seq), hv);
+}
+
+static bool assoc_resize_idle(struct assoc *a) {
+    return ((settings.hash_power == 0) && (a->expanding == 0) && (a->resize_power == 0) &&
+            (a->drained_hashtable == NULL));
 }
 
-void assoc_insert(struct item *it) {
-    struct item_slh *bucket;
-    assert(pthread_mutex_trylock(&cache_lock) != 0);
-    assert(assoc_find(item_key(it), it->nkey) == NULL);
-    bucket = assoc_get_bucket(item_key(it), it->nkey);
-    SLIST_INSERT_HEAD(bucket, it, h_sle);
-    nhash_item++;
-    if (assoc_expand_needed()) {
-        assoc_expand();
+static bool assoc_expand_needed(struct assoc *a) {
+    return (assoc_resize_idle(a) && (a->nhash_item > HASH_LOAD_FACTOR(a->hash_power)));
+}
+
+static bool assoc_shrink_needed(struct assoc *a) {
+    return (assoc_resize_idle(a) && (a->hash_power > hash_min_power) &&
+            (a->nhash_item < HASH_SHRINK_FACTOR(a->hash_power)));
+}
+
+void assoc_insert(struct shard *s, struct item *it) {
+    struct assoc *a = &s->assoc;
+    assert(shard_locked(s));
+    assert(assoc_find(s, item_key(it), it->nkey, it->hv) == NULL);
+    if (a->expanding == 1) {
+        assoc_migrate(a, HASH_HELP_SIZE);
+    }
+    assoc_bucket_push(assoc_get_bucket(a, it->hv), it->hv, it);
+    a->nhash_item++;
+    if (assoc_expand_needed(a)) {
+        assoc_request_resize(a, a->hash_power + 1);
     }
 }
 
-void assoc_delete(const char *key, size_t nkey) {
-    struct item_slh *bucket;
-    struct item *it, *prev;
-    assert(pthread_mutex_trylock(&cache_lock) != 0);
-    assert(assoc_find(key, nkey) != NULL);
-    bucket = assoc_get_bucket(key, nkey);
-    for (prev = NULL, it = SLIST_FIRST(bucket); it != NULL; prev = it, it = SLIST_NEXT(it, h_sle)) {
-        if ((nkey == it->nkey) && (memcmp(key, item_key(it), nkey) == 0)) {
-            break;
-        }
+void assoc_delete(struct shard *s, struct item *it) {
+    struct assoc *a = &s->assoc;
+    assert(shard_locked(s));
+    assert(assoc_find(s, item_key(it), it->nkey, it->hv) == it);
+    if (a->expanding == 1) {
+        assoc_migrate(a, HASH_HELP_SIZE);
     }
-    if (prev == NULL) {
-        SLIST_REMOVE_HEAD(bucket, h_sle);
-    } else {
-        SLIST_REMOVE_AFTER(prev, h_sle);
+    assoc_bucket_remove(a, assoc_get_bucket(a, it->hv), it);
+    a->nhash_item--;
+    if (assoc_shrink_needed(a)) {
+        assoc_request_resize(a, a->hash_power - 1);
     }
-    nhash_item--;
 }
@@ -2,11 +2,66 @@
 #define LOCAL_ASSOC_H_
 
 #include "cache.h"
+#include "item.h"
+
+#ifdef ASSOC_BUCKET
+#define ASSOC_BUCKET_SLOTS 6
+
+//one cache line: a tag byte and an item per slot, then the overflow bucket
+struct assoc_bucket {
+    uint8_t             tag[8];
+    struct item         *slot[ASSOC_BUCKET_SLOTS];
+    struct assoc_bucket *next;
+};
+#else
+//chain of items through h_next, by ref
+struct assoc_bucket {
+    uint32_t first;
+};
+#endif
+
+struct shard;
+
+struct assoc {
+    //primary hash table
+    struct assoc_bucket *primary_hashtable;
+    //older hash table
+    struct assoc_bucket *old_hashtable;
+    //hash item size
+    uint32_t        nhash_item;
+    //hash power
+    uint32_t        hash_power;
+    //power of the older hash table, one above or below hash_power
+    uint32_t        old_power;
+    //power the maintenance thread should resize to, 0 if none
+    uint32_t        resize_power;
+    //expanding flag, set while items move out of the older table
+    int             expanding;
+    //size transfered
+    uint32_t        expand_bucket;
+    //fully migrated older table, freed outside the lock
+    struct assoc_bucket *drained_hashtable;
+    uint32_t        drained_power;
+    //odd while items move between tables, for lock free readers
+    uint32_t        seq;
+#ifdef ASSOC_BUCKET
+    //emptied overflow buckets lock free readers may still be on, the older batch
+    //is freed once every reader has left epoch retired_epoch
+    struct assoc_bucket *retired;
+    struct assoc_bucket *retired_old;
+    uint64_t        retired_epoch;
+#endif
+};
 
 rstatus_t assoc_init(void);
 void assoc_deinit(void);
-struct item *assoc_find(const char *key, size_t nkey);
-void assoc_insert(struct item *item);
-void assoc_delete(const char *key, size_t nkey);
+struct item *assoc_find(struct shard *s, const char *key, size_t nkey, uint32_t hv);
+struct item *assoc_find_nolock(struct shard *s, const char *key, size_t nkey, uint32_t hv);
+bool assoc_contains(struct shard *s, struct item *it, uint32_t hv);
+void assoc_prefetch_bucket(struct shard *s, uint32_t hv);
+void assoc_prefetch_item(struct shard *s, uint32_t hv);
+void assoc_prefetch_item_nolock(struct shard *s, uint32_t hv);
+void assoc_insert(struct shard *s, struct item *item);
+void assoc_delete(struct shard *s, struct item *item);
 
 #endif
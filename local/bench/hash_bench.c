@@ -0,0 +1,95 @@
+//cycles per byte of each hash over 8-64 byte keys
+//build: cc -O2 -I.. -o hash_bench hash_bench.c ../hash.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hash.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_NKEY 4096
+#define BENCH_ROUNDS 512
+#define BENCH_MIN_LEN 8
+#define BENCH_MAX_LEN 64
+
+struct bench_hash {
+    const char  *name;
+    hash_func_t func;
+};
+
+static const struct bench_hash hashes[] = {
+    { "lookup3", hash_lookup3 },
+    { "wyhash", hash_wyhash },
+};
+
+//cycle counter where there is one, nanoseconds elsewhere
+static uint64_t bench_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+//keys start at odd offsets so the unaligned paths are measured too
+static double bench_run(hash_func_t func, char *buf, const uint32_t *len, const uint32_t *off, size_t nbyte) {
+    volatile uint32_t sink = 0;
+    uint64_t start, ticks, best = UINT64_MAX;
+    uint32_t r, i, acc;
+    for (r = 0; r < BENCH_ROUNDS; r++) {
+        start = bench_ticks();
+        for (i = 0, acc = 0; i < BENCH_NKEY; i++) {
+            acc += func(buf + off[i], len[i], 0);
+        }
+        ticks = bench_ticks() - start;
+        sink += acc;
+        if (ticks < best) {
+            best = ticks;
+        }
+    }
+    (void)sink;
+    return (double)best / nbyte;
+}
+
+int main(int argc, const char *argv[]) {
+    static uint32_t len[BENCH_NKEY], off[BENCH_NKEY];
+    char *buf;
+    size_t nbyte, h;
+    uint32_t i, l;
+    buf = malloc(BENCH_NKEY * (BENCH_MAX_LEN + 1));
+    if (buf == NULL) {
+        return 1;
+    }
+    for (i = 0; i < BENCH_NKEY * (BENCH_MAX_LEN + 1); i++) {
+        buf[i] = (char)rand();
+    }
+    for (i = 0; i < BENCH_NKEY; i++) {
+        off[i] = i * (BENCH_MAX_LEN + 1) + (i & 1);
+    }
+    printf("%-8s", "len");
+    for (h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++) {
+        printf("%12s", hashes[h].name);
+    }
+    printf("\n");
+    for (l = BENCH_MIN_LEN; l <= BENCH_MAX_LEN + 8; l += 8) {
+        for (i = 0, nbyte = 0; i < BENCH_NKEY; i++) {
+            //the last row mixes every length in range
+            len[i] = l <= BENCH_MAX_LEN ? l : BENCH_MIN_LEN + (uint32_t)rand() % (BENCH_MAX_LEN - BENCH_MIN_LEN + 1);
+            nbyte += len[i];
+        }
+        if (l <= BENCH_MAX_LEN) {
+            printf("%-8u", l);
+        } else {
+            printf("%-8s", "8-64");
+        }
+        for (h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++) {
+            printf("%12.3f", bench_run(hashes[h].func, buf, len, off, nbyte));
+        }
+        printf("\n");
+    }
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#!/bin/sh
+#miss ratio of each eviction policy, with and without admission, on the traces of trace_gen
+#build: cc -O2 -pthread -o main ../*.c -lm, run from this directory
+#usage: miss_ratio.sh zipf.txt scan.txt
+#main <trace> <evict_opt> <maxbytes in MB> <admit>, evict_opt 1 is EVICT_LRU, 16 EVICT_SLRU, 32 EVICT_CLOCK
+MAIN=${MAIN:-./main}
+printf '%-6s %4s %6s %6s %8s\n' trace MB policy admit miss
+for trace in "$@"; do
+    for mb in 4 8 16; do
+        for opt in 1 16 32; do
+            for admit in 0 1; do
+                ratio=$("$MAIN" "$trace" "$opt" "$mb" "$admit" | sed -n 's/.*miss ratio //p')
+                printf '%-6s %4s %6s %6s %8s\n' "$(basename "$trace" .txt)" "$mb" "$opt" "$admit" "$ratio"
+            done
+        done
+    done
+done
@@ -0,0 +1,71 @@
+//synthetic key traces for the replay mode of main, one key per line on stdout
+//build: cc -O2 -o trace_gen trace_gen.c -lm
+//usage: trace_gen zipf > zipf.txt, trace_gen scan > scan.txt, then miss_ratio.sh zipf.txt scan.txt
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+//hot keys follow zipf over this many keys
+#define TRACE_NKEY 200000
+#define TRACE_ALPHA 0.9
+#define TRACE_ROUNDS 20
+#define TRACE_ROUND_GETS 100000
+//one-off keys the scan trace adds after every round of hot gets
+#define TRACE_ROUND_SCAN 60000
+#define TRACE_SEED 7
+
+static uint64_t trace_state = TRACE_SEED;
+
+//splitmix64, so a trace is the same on every libc
+static uint64_t trace_rand(void) {
+    uint64_t z = (trace_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+//rank of a uniform draw in the cumulative weights
+static uint32_t trace_zipf(const double *cum) {
+    double u = (double)(trace_rand() >> 11) / (double)(1ULL << 53) * cum[TRACE_NKEY - 1];
+    uint32_t lo = 0, hi = TRACE_NKEY - 1, mid;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (cum[mid] <= u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int main(int argc, const char *argv[]) {
+    double *cum, t = 0;
+    uint32_t i, r, scan = 0;
+    int with_scan;
+    if (argc != 2 || (strcmp(argv[1], "zipf") != 0 && strcmp(argv[1], "scan") != 0)) {
+        fprintf(stderr, "usage: %s zipf|scan\n", argv[0]);
+        return 1;
+    }
+    with_scan = strcmp(argv[1], "scan") == 0;
+    cum = malloc(sizeof(*cum) * TRACE_NKEY);
+    if (cum == NULL) {
+        return 1;
+    }
+    for (i = 0; i < TRACE_NKEY; i++) {
+        t += 1.0 / pow(i + 1, TRACE_ALPHA);
+        cum[i] = t;
+    }
+    for (r = 0; r < TRACE_ROUNDS; r++) {
+        for (i = 0; i < TRACE_ROUND_GETS; i++) {
+            printf("h%u\n", trace_zipf(cum));
+        }
+        for (i = 0; with_scan && i < TRACE_ROUND_SCAN; i++) {
+            printf("s%u\n", scan++);
+        }
+    }
+    free(cum);
+    return 0;
+}
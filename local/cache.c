@@ -1,17 +1,27 @@
 #include "cache.h"
 #include <unistd.h>
+#include <time.h>
 
 static time_t process_started;
+static int64_t clock_started;
 static pthread_t time_reflush_tid;
-static volatile int now;
 static volatile int run_time_reflush_thread;
+static void (*time_tick)(int now);
 
+//coarse monotonic clock in ms, a vdso read with no syscall
+static int64_t time_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//wakes on each second boundary of the clock to hand the new second to the tick
 static void *time_update(void *arg) {
     while (run_time_reflush_thread) {
-    	struct timeval timer;
-    	gettimeofday(&timer, NULL);
-    	now = (int) (timer.tv_sec - process_started);
-    	sleep(1);
+        int64_t ms = time_now_ms();
+        struct timespec ts = {0, (long)(1000 - ms % 1000) * 1000000};
+        nanosleep(&ts, NULL);
+        time_tick(time_now());
     }
     return NULL;
 }
@@ -20,12 +30,24 @@ time_t time_started(void) {
     return process_started;
 }
 
+int64_t time_now_ms(void) {
+    return time_clock_ms() - clock_started;
+}
+
 int time_now(void) {
-    return now;
+    return (int)(time_now_ms() / 1000);
+}
+
+//called by the clock thread on each new second, set before time_init
+void time_on_tick(void (*tick)(int now)) {
+    time_tick = tick;
 }
 
 rstatus_t time_init(void) {
     process_started = time(NULL) - 2;
+    clock_started = time_clock_ms() - 2000;
+    run_time_reflush_thread = 0;
+    if (time_tick == NULL) return MC_OK;
     run_time_reflush_thread = 1;
     int err = pthread_create(&time_reflush_tid, NULL, time_update, NULL);
     if (err != 0) return MC_ERROR;
@@ -33,7 +55,7 @@ rstatus_t time_init(void) {
 }
 
 void time_deinit(void) {
+    if (!run_time_reflush_thread) return;
 	run_time_reflush_thread = 0;
 	pthread_join(time_reflush_tid, NULL);
 }
-
@@ -22,7 +22,19 @@ typedef int rstatus_t;
 #define EVICT_RS 0x02 //random
 #define EVICT_AS 0x04 //least accessed
 #define EVICT_CS 0x08 //least created
-#define EVICT_INVALID 0x10 //go no further
+#define EVICT_SLRU 0x10 //segmented lru, items hit again move from probation to protected
+#define EVICT_CLOCK 0x20 //second chance, reads only set a reference bit
+#define EVICT_INVALID 0x40 //go no further
+
+#define HASH_LOOKUP3 0x00 //bob jenkins' lookup3
+#define HASH_WYHASH 0x01 //wyhash, 64 bit folded
+
+#define ENGINE_SLAB 0x00 //items in slab classes, linked on lru queues
+#define ENGINE_SEG 0x01 //items appended to segments by ttl, expired and merged a segment at a time
+
+#define HUGEPAGE_NONE 0x00 //regular pages
+#define HUGEPAGE_TRANSPARENT 0x01 //madvise the heap for transparent huge pages
+#define HUGEPAGE_EXPLICIT 0x02 //map the heap from the hugetlb pool
 
 struct settings {
 	int     hash_power;
@@ -30,10 +42,28 @@ struct settings {
 	int     evict_opt;
 	size_t  maxbytes;
 	size_t  profile[UCHAR_MAX];
-    uint8_t profile_last_id;
+    uint8_t profile_last_id; //0 to generate the profile from the three below
+	size_t  profile_min; //smallest generated class
+	size_t  profile_max; //largest generated class, the slab size when 0
+	double  profile_factor; //growth from one generated class to the next
+	uint32_t profile_sample; //stored sizes sampled for local_profile, one in this many, 0 for none
 	bool    use_freeq;
 	size_t  slab_size;
 	bool    use_lruq;
+	uint32_t nshard; //independent partitions chosen by key hash, 0 for one
+	bool    lockfree_read; //lookups skip the shard lock, reuse waits for an epoch
+	bool    use_magazine; //per thread caches of free items in front of the slabs
+	bool    use_admit; //tinylfu, a put is refused when the item it would evict is read more often
+	bool    use_readbuf; //lock free reads queue their lru touches per thread, applied in batches under the lock
+	int     hash_opt; //key hash function, HASH_*
+	int     huge_page; //page backing of a preallocated heap, HUGEPAGE_*
+	uint32_t prefault_threads; //threads touching a preallocated heap at start, 0 for none
+	const char *heap_path; //file backing a preallocated heap, reattached on the next start
+	uint32_t rebalance_ms; //least time between two slab moves across classes of a shard, 0 for none
+	uint32_t compact_ms; //least time between two compactions of a sparse slab in a shard, 0 for none
+	uint32_t crawl_ms; //pause between two passes of the expiry crawler over every lru, 0 for none
+	bool    use_wheel; //index items by exptime in a timing wheel the clock thread frees them from, needs ITEM_WHEEL
+	int     engine; //storage engine, ENGINE_*
 };
 
 #define TAILQ_ENTRY(type) \
@@ -132,6 +162,15 @@ struct { \
     *(elm)->field.tqe_prev = TAILQ_NEXT((elm), field); \
 } while (0)
 
+#define TAILQ_INSERT_AFTER(head, listelm, elm, field) do { \
+    if ((TAILQ_NEXT((elm), field) = TAILQ_NEXT((listelm), field)) != NULL) \
+        TAILQ_NEXT((elm), field)->field.tqe_prev = &TAILQ_NEXT((elm), field); \
+    else \
+        (head)->tqh_last = &TAILQ_NEXT((elm), field); \
+    TAILQ_NEXT((listelm), field) = (elm); \
+    (elm)->field.tqe_prev = &TAILQ_NEXT((listelm), field); \
+} while (0)
+
 #define TAILQ_INSERT_HEAD(head, elm, field) do { \
     if ((TAILQ_NEXT((elm), field) = TAILQ_FIRST((head))) != NULL) \
         TAILQ_FIRST((head))->field.tqe_prev = &TAILQ_NEXT((elm), field); \
@@ -142,6 +181,9 @@ struct { \
 } while (0)
 
 int time_now(void);
+int64_t time_now_ms(void);
+time_t time_started(void);
+void time_on_tick(void (*tick)(int now));
 rstatus_t time_init(void);
 void time_deinit(void);
 
@@ -0,0 +1,378 @@
+#include "dump.h"
+#include "item.h"
+#include "slabs.h"
+#include "shard.h"
+#include "hash.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define DUMP_VERSION 2
+#define DUMP_LOAD_MAX_THREADS 64
+
+extern struct settings settings;
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+//crc32 (ieee, reflected) over each chunk payload
+static void dump_crc_init(void) {
+    uint32_t i, j, c;
+    for (i = 0; i < 256; i++) {
+        for (c = i, j = 0; j < 8; j++) {
+            c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t dump_crc(const uint8_t *p, size_t n) {
+    uint32_t c = 0xffffffff;
+    while (n-- > 0) {
+        c = crc_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffff;
+}
+
+struct dump_writer {
+    FILE              *fp;
+    uint8_t           *buf;
+    size_t            cap;
+    struct iovec      *iov;
+    uint32_t          niov;
+    struct item       *pins[DUMP_SLICE_ITEMS];
+    uint32_t          npin;
+    struct dump_chunk chunk;
+};
+
+static rstatus_t dump_flush(struct dump_writer *w) {
+    w->chunk.magic = DUMP_CHUNK_MAGIC;
+    w->chunk.crc = dump_crc(w->buf, w->chunk.nbyte);
+    if (fwrite(&w->chunk, sizeof(w->chunk), 1, w->fp) != 1) {
+        return MC_ERROR;
+    }
+    if (w->chunk.nbyte > 0 && fwrite(w->buf, w->chunk.nbyte, 1, w->fp) != 1) {
+        return MC_ERROR;
+    }
+    w->chunk.nitem = 0;
+    w->chunk.nbyte = 0;
+    return MC_OK;
+}
+
+//a chained value larger than a chunk gets an empty chunk grown to fit it
+static bool dump_fits(struct dump_writer *w, struct item *it) {
+    size_t need = w->chunk.nbyte + sizeof(struct dump_record) + it->nkey + it->nbyte;
+    uint8_t *buf;
+    if (need <= w->cap) {
+        return true;
+    }
+    if (w->chunk.nbyte > 0 || (buf = realloc(w->buf, need)) == NULL) {
+        return false;
+    }
+    w->buf = buf;
+    w->cap = need;
+    return true;
+}
+
+static rstatus_t dump_append(struct dump_writer *w, struct item *it, int64_t now) {
+    struct dump_record rec;
+    struct iovec *iov;
+    uint8_t *p = w->buf + w->chunk.nbyte;
+    uint32_t i, niov;
+    niov = item_iov(it, w->iov, w->niov);
+    if (niov > w->niov) {
+        iov = realloc(w->iov, sizeof(*iov) * niov);
+        if (iov == NULL) {
+            return MC_ENOMEM;
+        }
+        w->iov = iov;
+        w->niov = niov;
+        item_iov(it, w->iov, w->niov);
+    }
+    rec.nkey = it->nkey;
+    rec.nbyte = it->nbyte;
+    rec.ttl_ms = (int64_t)it->exptime - now;
+    memcpy(p, &rec, sizeof(rec));
+    p += sizeof(rec);
+    memcpy(p, item_key(it), it->nkey);
+    p += it->nkey;
+    for (i = 0; i < niov; i++) {
+        memcpy(p, w->iov[i].iov_base, w->iov[i].iov_len);
+        p += w->iov[i].iov_len;
+    }
+    w->chunk.nitem++;
+    w->chunk.nbyte = (uint32_t)(p - w->buf);
+    return MC_OK;
+}
+
+//pin up to DUMP_SLICE_ITEMS live items or DUMP_SLICE_BYTES under the lock, false once the shard is done
+static bool dump_slice(struct dump_writer *w, struct shard *s, uint32_t *sidx, uint32_t *idx) {
+    struct slab *slab;
+    struct item *it;
+    size_t nbyte = 0;
+    bool more = true;
+    pthread_mutex_lock(&s->lock);
+    while (w->npin < DUMP_SLICE_ITEMS && nbyte < DUMP_SLICE_BYTES) {
+        slab = slab_by_index(s, *sidx);
+        if (slab == NULL) {
+            more = false;
+            break;
+        }
+        if (*idx >= slab_nitem(slab)) {
+            (*sidx)++;
+            *idx = 0;
+            continue;
+        }
+        it = slab_item(slab, (*idx)++);
+        if (!item_is_linked(it) || item_expired(it)) {
+            continue;
+        }
+        item_pin(s, it);
+        w->pins[w->npin++] = it;
+        nbyte += it->nkey + it->nbyte;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return more;
+}
+
+//copy the pinned items with no lock held, writing out each chunk as it fills
+static rstatus_t dump_copy(struct dump_writer *w) {
+    int64_t now = time_now_ms();
+    uint32_t i;
+    for (i = 0; i < w->npin; i++) {
+        if (!dump_fits(w, w->pins[i])) {
+            if (dump_flush(w) != MC_OK) {
+                return MC_ERROR;
+            }
+            if (!dump_fits(w, w->pins[i])) {
+                return MC_ENOMEM;
+            }
+        }
+        if (dump_append(w, w->pins[i], now) != MC_OK) {
+            return MC_ENOMEM;
+        }
+    }
+    return MC_OK;
+}
+
+static void dump_unpin(struct dump_writer *w, struct shard *s) {
+    uint32_t i;
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < w->npin; i++) {
+        item_unpin(s, w->pins[i]);
+    }
+    pthread_mutex_unlock(&s->lock);
+    w->npin = 0;
+}
+
+static rstatus_t dump_write(struct dump_writer *w) {
+    struct dump_hdr hdr;
+    uint32_t i, sidx, idx;
+    rstatus_t status;
+    bool more;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = DUMP_MAGIC;
+    hdr.version = DUMP_VERSION;
+    if (fwrite(&hdr, sizeof(hdr), 1, w->fp) != 1) {
+        return MC_ERROR;
+    }
+    for (i = 0; i < nshard; i++) {
+        sidx = 0;
+        idx = 0;
+        do {
+            more = dump_slice(w, &shards[i], &sidx, &idx);
+            status = dump_copy(w);
+            dump_unpin(w, &shards[i]);
+            if (status != MC_OK) {
+                return status;
+            }
+        } while (more);
+    }
+    if (w->chunk.nitem > 0 && dump_flush(w) != MC_OK) {
+        return MC_ERROR;
+    }
+    //the empty chunk marks a complete dump
+    return dump_flush(w);
+}
+
+//write every live item to path, replacing it only once the dump is complete
+rstatus_t dump_save(const char *path) {
+    struct dump_writer w;
+    char *tmp;
+    rstatus_t status;
+    pthread_once(&crc_once, dump_crc_init);
+    memset(&w, 0, sizeof(w));
+    //room for the largest item on its own
+    w.cap = DUMP_CHUNK_SIZE + sizeof(struct dump_record) + settings.slab_size;
+    w.buf = malloc(w.cap);
+    tmp = malloc(strlen(path) + sizeof(".tmp"));
+    if (w.buf == NULL || tmp == NULL) {
+        free(w.buf);
+        free(tmp);
+        return MC_ENOMEM;
+    }
+    sprintf(tmp, "%s.tmp", path);
+    w.fp = fopen(tmp, "wb");
+    if (w.fp == NULL) {
+        free(w.buf);
+        free(tmp);
+        return MC_ERROR;
+    }
+    status = dump_write(&w);
+    if (fclose(w.fp) != 0) {
+        status = MC_ERROR;
+    }
+    if (status == MC_OK && rename(tmp, path) != 0) {
+        status = MC_ERROR;
+    }
+    if (status != MC_OK) {
+        unlink(tmp);
+    }
+    free(w.buf);
+    free(w.iov);
+    free(tmp);
+    return status;
+}
+
+struct dump_loader {
+    pthread_mutex_t lock;
+    FILE            *fp;
+    size_t          max_nbyte;
+    bool            done;
+    rstatus_t       status;
+};
+
+//next chunk payload into *buf, 0 at the end marker and -1 on a bad stream
+static int dump_read_chunk(struct dump_loader *ld, uint8_t **buf, size_t *cap, struct dump_chunk *chunk) {
+    uint8_t *more;
+    if (fread(chunk, sizeof(*chunk), 1, ld->fp) != 1 || chunk->magic != DUMP_CHUNK_MAGIC ||
+        chunk->nbyte > ld->max_nbyte) {
+        return -1;
+    }
+    if (chunk->nitem == 0) {
+        return 0;
+    }
+    if (chunk->nbyte > *cap) {
+        more = realloc(*buf, chunk->nbyte);
+        if (more == NULL) {
+            return -1;
+        }
+        *buf = more;
+        *cap = chunk->nbyte;
+    }
+    if (fread(*buf, chunk->nbyte, 1, ld->fp) != 1) {
+        return -1;
+    }
+    return 1;
+}
+
+static rstatus_t dump_insert(const uint8_t *p, const struct dump_chunk *chunk) {
+    const uint8_t *end = p + chunk->nbyte;
+    struct dump_record rec;
+    char *key, *value;
+    uint32_t i;
+    uint8_t id;
+    for (i = 0; i < chunk->nitem; i++) {
+        if ((size_t)(end - p) < sizeof(rec)) {
+            return MC_ERROR;
+        }
+        memcpy(&rec, p, sizeof(rec));
+        p += sizeof(rec);
+        if ((size_t)(end - p) < (size_t)rec.nkey + rec.nbyte || rec.nkey == 0 || rec.nbyte == 0) {
+            return MC_ERROR;
+        }
+        key = (char *)p;
+        value = key + rec.nkey;
+        p += rec.nkey + rec.nbyte;
+        //expired on the way, or too big for this profile
+        if (rec.ttl_ms <= 0) {
+            continue;
+        }
+        id = item_slabid(rec.nkey, rec.nbyte);
+        if (id != SLABCLASS_INVALID_ID) {
+            item_alloc(id, key, rec.nkey, hash(key, rec.nkey, 0), rec.ttl_ms, value, rec.nbyte);
+        } else if ((id = item_chain_slabid(rec.nkey, rec.nbyte)) != SLABCLASS_INVALID_ID) {
+            item_alloc_chain(id, key, rec.nkey, hash(key, rec.nkey, 0), rec.ttl_ms, value, rec.nbyte);
+        }
+    }
+    return p == end ? MC_OK : MC_ERROR;
+}
+
+static void *dump_load_thread(void *arg) {
+    struct dump_loader *ld = arg;
+    struct dump_chunk chunk;
+    uint8_t *buf = NULL;
+    size_t cap = 0;
+    int ret;
+    for (;;) {
+        pthread_mutex_lock(&ld->lock);
+        if (ld->done) {
+            pthread_mutex_unlock(&ld->lock);
+            break;
+        }
+        ret = dump_read_chunk(ld, &buf, &cap, &chunk);
+        if (ret <= 0) {
+            ld->done = true;
+            if (ret < 0) {
+                ld->status = MC_ERROR;
+            }
+        }
+        pthread_mutex_unlock(&ld->lock);
+        if (ret <= 0) {
+            break;
+        }
+        //checksum and inserts run in parallel, only the reads are serialized
+        if (dump_crc(buf, chunk.nbyte) != chunk.crc || dump_insert(buf, &chunk) != MC_OK) {
+            pthread_mutex_lock(&ld->lock);
+            ld->done = true;
+            ld->status = MC_ERROR;
+            pthread_mutex_unlock(&ld->lock);
+            break;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+//insert the items of a dump with nthread threads, one per online cpu when 0
+rstatus_t dump_load(const char *path, uint32_t nthread) {
+    struct dump_loader ld;
+    struct dump_hdr hdr;
+    pthread_t tids[DUMP_LOAD_MAX_THREADS];
+    uint32_t i, n;
+    long ncpu;
+    pthread_once(&crc_once, dump_crc_init);
+    if (nthread == 0) {
+        ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthread = ncpu > 0 ? (uint32_t)ncpu : 1;
+    }
+    if (nthread > DUMP_LOAD_MAX_THREADS) {
+        nthread = DUMP_LOAD_MAX_THREADS;
+    }
+    memset(&ld, 0, sizeof(ld));
+    ld.fp = fopen(path, "rb");
+    if (ld.fp == NULL) {
+        return MC_ERROR;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, ld.fp) != 1 || hdr.magic != DUMP_MAGIC || hdr.version != DUMP_VERSION) {
+        fclose(ld.fp);
+        return MC_ERROR;
+    }
+    ld.max_nbyte = DUMP_CHUNK_SIZE + sizeof(struct dump_record) + settings.slab_size + item_max_nbyte();
+    ld.status = MC_OK;
+    pthread_mutex_init(&ld.lock, NULL);
+    for (n = 0; n < nthread; n++) {
+        if (pthread_create(&tids[n], NULL, dump_load_thread, &ld) != 0) {
+            break;
+        }
+    }
+    if (n == 0) {
+        dump_load_thread(&ld);
+    }
+    for (i = 0; i < n; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_mutex_destroy(&ld.lock);
+    fclose(ld.fp);
+    return ld.status;
+}
@@ -0,0 +1,38 @@
+#ifndef LOCAL_DUMP_H_
+#define LOCAL_DUMP_H_
+#include "cache.h"
+
+#define DUMP_MAGIC 0x31504d55444c434cULL
+#define DUMP_CHUNK_MAGIC 0x4b4e4843
+#define DUMP_CHUNK_SIZE (1024 * 1024)
+//items pinned per shard lock hold, then copied with the lock dropped
+#define DUMP_SLICE_ITEMS 256
+//bytes pinned per lock hold, so a dump keeps little memory from eviction
+#define DUMP_SLICE_BYTES DUMP_CHUNK_SIZE
+
+//a dump is the file header, then chunks, then a chunk with no items
+struct dump_hdr {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags;
+};
+
+//followed by nbyte of records, each a dump_record then key then value
+struct dump_chunk {
+    uint32_t magic;
+    uint32_t nitem;
+    uint32_t nbyte;
+    uint32_t crc;
+};
+
+//ttl_ms is the time left at dump time, loaded back as the ttl of a put
+struct dump_record {
+    uint16_t nkey;
+    uint32_t nbyte;
+    int64_t  ttl_ms;
+} __attribute__((packed));
+
+rstatus_t dump_save(const char *path);
+rstatus_t dump_load(const char *path, uint32_t nthread);
+
+#endif
@@ -0,0 +1,106 @@
+#include "epoch.h"
+#include <sched.h>
+
+struct epoch_record {
+    uint64_t            epoch;
+    uint32_t            depth;
+    int                 in_use;
+    struct epoch_record *next;
+};
+
+static uint64_t epoch_global = 1;
+static struct epoch_record *epoch_records;
+static pthread_key_t epoch_key;
+static __thread struct epoch_record *epoch_self;
+
+static void epoch_record_release(void *arg) {
+    struct epoch_record *rec = arg;
+    __atomic_store_n(&rec->epoch, EPOCH_INACTIVE, __ATOMIC_SEQ_CST);
+    rec->depth = 0;
+    __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static int epoch_key_err;
+
+static void epoch_key_init(void) {
+    epoch_key_err = pthread_key_create(&epoch_key, epoch_record_release);
+}
+
+rstatus_t epoch_init(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, epoch_key_init);
+    return epoch_key_err == 0 ? MC_OK : MC_ERROR;
+}
+
+static struct epoch_record *epoch_register(void) {
+    struct epoch_record *rec;
+    int expected;
+    for (rec = __atomic_load_n(&epoch_records, __ATOMIC_ACQUIRE); rec != NULL; rec = rec->next) {
+        expected = 0;
+        if (__atomic_compare_exchange_n(&rec->in_use, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            goto done;
+        }
+    }
+    rec = calloc(1, sizeof(*rec));
+    if (rec == NULL) {
+        abort();
+    }
+    rec->in_use = 1;
+    rec->next = __atomic_load_n(&epoch_records, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&epoch_records, &rec->next, rec, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+done:
+    pthread_setspecific(epoch_key, rec);
+    epoch_self = rec;
+    return rec;
+}
+
+void epoch_enter(void) {
+    struct epoch_record *rec = epoch_self;
+    if (rec == NULL) {
+        rec = epoch_register();
+    }
+    if (rec->depth++ == 0) {
+        __atomic_store_n(&rec->epoch, __atomic_load_n(&epoch_global, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    }
+}
+
+void epoch_exit(void) {
+    struct epoch_record *rec = epoch_self;
+    assert(rec != NULL && rec->depth > 0);
+    if (--rec->depth == 0) {
+        __atomic_store_n(&rec->epoch, EPOCH_INACTIVE, __ATOMIC_RELEASE);
+    }
+}
+
+bool epoch_entered(void) {
+    return epoch_self != NULL && epoch_self->depth > 0;
+}
+
+uint64_t epoch_now(void) {
+    return __atomic_load_n(&epoch_global, __ATOMIC_SEQ_CST);
+}
+
+uint64_t epoch_advance(void) {
+    return __atomic_add_fetch(&epoch_global, 1, __ATOMIC_SEQ_CST);
+}
+
+uint64_t epoch_safe(void) {
+    struct epoch_record *rec;
+    uint64_t safe, e;
+    safe = epoch_now();
+    for (rec = __atomic_load_n(&epoch_records, __ATOMIC_ACQUIRE); rec != NULL; rec = rec->next) {
+        e = __atomic_load_n(&rec->epoch, __ATOMIC_SEQ_CST);
+        if (e != EPOCH_INACTIVE && e < safe) {
+            safe = e;
+        }
+    }
+    return safe;
+}
+
+void epoch_synchronize(void) {
+    uint64_t target = epoch_advance();
+    while (epoch_safe() < target) {
+        sched_yield();
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef LOCAL_EPOCH_H_
+#define LOCAL_EPOCH_H_
+#include "cache.h"
+
+//epoch 0 marks an idle reader, so the global epoch starts at 1
+#define EPOCH_INACTIVE 0
+
+rstatus_t epoch_init(void);
+//enter and leave a read side critical section, may nest
+void epoch_enter(void);
+void epoch_exit(void);
+bool epoch_entered(void);
+//current global epoch, tag for anything retired now
+uint64_t epoch_now(void);
+uint64_t epoch_advance(void);
+//anything retired with an epoch below this can be reused
+uint64_t epoch_safe(void);
+//wait until everything retired before the call can be reused
+void epoch_synchronize(void);
+
+//recover a full epoch from its low 32 bits, never below the real value
+static inline uint64_t epoch_widen(uint32_t e) {
+    uint64_t now = epoch_now();
+    return now - (uint32_t)((uint32_t)now - e);
+}
+
+#endif
@@ -33,7 +33,7 @@ c ^= b; c -= rot(b,24); \
 }
 
 #if HASH_LITTLE_ENDIAN == 1
-uint32_t hash(const void *key, size_t length, const uint32_t initval) {
+uint32_t hash_lookup3(const void *key, size_t length, const uint32_t initval) {
 	uint32_t a,b,c;
 	union { const void *ptr; size_t i; } u;
 	a = b = c = 0xdeadbeef + ((uint32_t)length) + initval;
@@ -127,19 +127,13 @@ uint32_t hash(const void *key, size_t length, const uint32_t initval) {
 		}
 	} else {
 		const uint8_t *k = key;
+		uint32_t w[3];
+		//unaligned little endian words load as is, same value as byte by byte
 		while (length > 12) {
-			a += k[0];
-			a += ((uint32_t)k[1])<<8;
-			a += ((uint32_t)k[2])<<16;
-			a += ((uint32_t)k[3])<<24;
-			b += k[4];
-			b += ((uint32_t)k[5])<<8;
-			b += ((uint32_t)k[6])<<16;
-			b += ((uint32_t)k[7])<<24;
-			c += k[8];
-			c += ((uint32_t)k[9])<<8;
-			c += ((uint32_t)k[10])<<16;
-			c += ((uint32_t)k[11])<<24;
+			memcpy(w, k, sizeof(w));
+			a += w[0];
+			b += w[1];
+			c += w[2];
 			mix(a,b,c);
 			length -= 12;
 			k += 12;
@@ -167,7 +161,7 @@ uint32_t hash(const void *key, size_t length, const uint32_t initval) {
 
 #elif HASH_BIG_ENDIAN == 1
 
-uint32_t hash( const void *key, size_t length, const uint32_t initval) {
+uint32_t hash_lookup3(const void *key, size_t length, const uint32_t initval) {
 	uint32_t a,b,c;
 	union { const void *ptr; size_t i; } u;
 	a = b = c = 0xdeadbeef + ((uint32_t)length) + initval;
@@ -262,3 +256,98 @@ uint32_t hash( const void *key, size_t length, const uint32_t initval) {
 #error Must define HASH_BIG_ENDIAN or HASH_LITTLE_ENDIAN
 #endif
 
+
+static const uint64_t wy_secret[4] = {
+	0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+static inline void wy_mum(uint64_t *a, uint64_t *b) {
+	__uint128_t r = (__uint128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+	wy_mum(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t wy_r8(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t wy_r4(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t wy_r3(const uint8_t *p, size_t k) {
+	return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+//wyhash final version 4, overlapping loads so short keys take no byte loop
+uint64_t hash_wyhash64(const void *key, size_t length, uint64_t seed) {
+	const uint8_t *p = key;
+	uint64_t a, b;
+	size_t i;
+	seed ^= wy_mix(seed ^ wy_secret[0], wy_secret[1]);
+	if (length <= 16) {
+		if (length >= 4) {
+			a = (wy_r4(p) << 32) | wy_r4(p + ((length >> 3) << 2));
+			b = (wy_r4(p + length - 4) << 32) | wy_r4(p + length - 4 - ((length >> 3) << 2));
+		} else if (length > 0) {
+			a = wy_r3(p, length);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		i = length;
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = wy_mix(wy_r8(p) ^ wy_secret[1], wy_r8(p + 8) ^ seed);
+				see1 = wy_mix(wy_r8(p + 16) ^ wy_secret[2], wy_r8(p + 24) ^ see1);
+				see2 = wy_mix(wy_r8(p + 32) ^ wy_secret[3], wy_r8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wy_mix(wy_r8(p) ^ wy_secret[1], wy_r8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = wy_r8(p + i - 16);
+		b = wy_r8(p + i - 8);
+	}
+	a ^= wy_secret[1];
+	b ^= seed;
+	wy_mum(&a, &b);
+	return wy_mix(a ^ wy_secret[0] ^ length, b ^ wy_secret[1]);
+}
+
+uint32_t hash_wyhash(const void *key, size_t length, const uint32_t initval) {
+	uint64_t h = hash_wyhash64(key, length, initval);
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+hash_func_t hash_func = hash_lookup3;
+
+rstatus_t hash_init(int hash_opt) {
+	switch (hash_opt) {
+	case HASH_LOOKUP3:
+		hash_func = hash_lookup3;
+		break;
+	case HASH_WYHASH:
+		hash_func = hash_wyhash;
+		break;
+	default:
+		return MC_ERROR;
+	}
+	return MC_OK;
+}
@@ -1,9 +1,20 @@
 #ifndef LOCAL_HASH_H_
 #define LOCAL_HASH_H_
-#include <stddef.h>
-#include <stdint.h>
+#include "cache.h"
 
-uint32_t hash(const void *key, size_t length, const uint32_t initval);
+typedef uint32_t (*hash_func_t)(const void *key, size_t length, const uint32_t initval);
 
-#endif
+extern hash_func_t hash_func;
+
+//Bob Jenkins' lookup3, the original and default
+uint32_t hash_lookup3(const void *key, size_t length, const uint32_t initval);
+//wyhash folded to 32 bits
+uint32_t hash_wyhash(const void *key, size_t length, const uint32_t initval);
+uint64_t hash_wyhash64(const void *key, size_t length, uint64_t seed);
+rstatus_t hash_init(int hash_opt);
 
+static inline uint32_t hash(const void *key, size_t length, const uint32_t initval) {
+    return hash_func(key, length, initval);
+}
+
+#endif
@@ -1,25 +1,138 @@
 #include "item.h"
 #include "assoc.h"
 #include "slabs.h"
+#include "shard.h"
+#include "epoch.h"
+#include "admit.h"
+#include <sys/uio.h>
 
 extern struct settings settings;
 
 #define ITEM_UPDATE_INTERVAL 3
 #define ITEM_LRUQ_MAX_TRIES 50
+//share of a class's items the protected queue of a segmented lru may hold
+#define ITEM_PROTECTED_PERCENT 80
+#define ITEM_LIMBO_RECLAIM 64
+#define ITEM_SYNC_MAX_TRIES 4
 
-pthread_mutex_t cache_lock;
-struct item_tqh item_lruq[SLABCLASS_MAX_IDS];
-
-static bool item_expired(struct item *it) {
+bool item_expired(struct item *it) {
     assert(it->magic == ITEM_MAGIC);
-    return (it->exptime > 0 && it->exptime < time_now()) ? true : false;
+    return (it->exptime > 0 && (int64_t)it->exptime <= time_now_ms()) ? true : false;
+}
+
+//reads waiting to touch the lru of one shard, the hv lets a stale pointer be caught
+struct item_readbuf {
+    uint32_t    n;
+    struct item *its[ITEM_READBUF_SIZE];
+    uint32_t    hvs[ITEM_READBUF_SIZE];
+};
+
+//bytes the expiry crawler gave back, in all and in its last full pass
+struct item_crawler {
+    uint64_t  nbyte;
+    uint64_t  last_nbyte;
+    uint64_t  npass;
+    pthread_t tid;
+};
+
+static struct item_crawler crawler;
+static pthread_key_t readbuf_key;
+static __thread struct item_readbuf *readbufs;
+static __thread uint32_t nreadbuf;
+
+//a buffer dies with its thread, its touches are simply lost
+static void item_readbuf_destroy(void *arg) {
+    free(arg);
+}
+
+static void item_readbuf_key_init(void) {
+    pthread_key_create(&readbuf_key, item_readbuf_destroy);
+}
+
+static void item_wheel_init(struct item_wheel *w) {
+    uint32_t i;
+    w->time = 0;
+    for (i = 0; i < ITEM_WHEEL_NSLOT; i++) {
+        ITEMQ_INIT(&w->slot[i]);
+    }
+    w->nexpired = 0;
 }
 
+#ifdef ITEM_WHEEL
+//the slot an exptime goes to, by how far ahead of the wheel it is
+static uint8_t item_wheel_slot(struct item_wheel *w, int exptime) {
+    int d = exptime - w->time;
+    if (d < ITEM_WHEEL_SEC) {
+        return (uint8_t)((d < 0 ? w->time : exptime) % ITEM_WHEEL_SEC);
+    }
+    if (d < ITEM_WHEEL_SEC * ITEM_WHEEL_MIN) {
+        return (uint8_t)(ITEM_WHEEL_SEC + exptime / ITEM_WHEEL_SEC % ITEM_WHEEL_MIN);
+    }
+    if (d < ITEM_WHEEL_SEC * ITEM_WHEEL_MIN * ITEM_WHEEL_HOUR) {
+        return (uint8_t)(ITEM_WHEEL_SEC + ITEM_WHEEL_MIN + exptime / (ITEM_WHEEL_SEC * ITEM_WHEEL_MIN) % ITEM_WHEEL_HOUR);
+    }
+    return ITEM_WHEEL_NSLOT - 1;
+}
+
+static void item_wheel_link(struct shard *s, struct item *it) {
+    if (!settings.use_wheel || it->exptime == 0) {
+        return;
+    }
+    it->wslot = item_wheel_slot(&s->wheel, item_exptime_sec(it));
+    ITEMQ_INSERT_TAIL(&s->wheel.slot[it->wslot], it, w_tqe);
+}
+
+//the slot is kept in the item since a ref list needs its head to unlink the first item
+static void item_wheel_unlink(struct shard *s, struct item *it) {
+    if (it->wslot == ITEM_WHEEL_NONE) {
+        return;
+    }
+    ITEMQ_REMOVE(&s->wheel.slot[it->wslot], it, w_tqe);
+    it->wslot = ITEM_WHEEL_NONE;
+}
+
+static void item_wheel_clear(struct item *it) {
+    it->wslot = ITEM_WHEEL_NONE;
+}
+
+//nit takes the wheel slot of it
+static void item_wheel_move(struct shard *s, struct item *it, struct item *nit) {
+    nit->wslot = it->wslot;
+    if (it->wslot != ITEM_WHEEL_NONE) {
+        ITEMQ_INSERT_AFTER(&s->wheel.slot[it->wslot], it, nit, w_tqe);
+        ITEMQ_REMOVE(&s->wheel.slot[it->wslot], it, w_tqe);
+        it->wslot = ITEM_WHEEL_NONE;
+    }
+}
+#else
+static void item_wheel_link(struct shard *s, struct item *it) {
+}
+
+static void item_wheel_unlink(struct shard *s, struct item *it) {
+}
+
+static void item_wheel_clear(struct item *it) {
+}
+
+static void item_wheel_move(struct shard *s, struct item *it, struct item *nit) {
+}
+#endif
+
 void item_init(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
     uint8_t i;
-    pthread_mutex_init(&cache_lock, NULL);
-    for (i = SLABCLASS_MIN_ID; i <= SLABCLASS_MAX_ID; i++) {
-        TAILQ_INIT(&item_lruq[i]);
+    uint32_t j;
+    pthread_once(&once, item_readbuf_key_init);
+    for (j = 0; j < nshard; j++) {
+        for (i = SLABCLASS_MIN_ID; i <= SLABCLASS_MAX_ID; i++) {
+            ITEMQ_INIT(&shards[j].item_lruq[i]);
+            ITEMQ_INIT(&shards[j].item_protq[i]);
+            shards[j].item_nlruq[i] = 0;
+            shards[j].item_nprotq[i] = 0;
+        }
+        ITEMQ_INIT(&shards[j].item_limboq);
+        shards[j].nlimbo = 0;
+        item_wheel_init(&shards[j].wheel);
     }
 }
 
@@ -34,73 +147,235 @@ char* item_data(struct item *it) {
 struct slab* item_2_slab(struct item *it) {
     struct slab *slab;
     assert(it->magic == ITEM_MAGIC);
-    assert(it->offset < settings.slab_size);
-    slab = (struct slab *)((uint8_t *)it - it->offset);
+    //every slab starts a slab_size step from heap_base
+    slab = (struct slab *)((uint8_t *)it - (size_t)((uint8_t *)it - heap_base) % settings.slab_size);
     assert(slab->magic == SLAB_MAGIC);
     return slab;
 }
 
-static void item_acquire_refcount(struct item *it) {
-	assert(pthread_mutex_trylock(&cache_lock) != 0);
+struct shard* item_2_shard(struct item *it) {
+    return shard_by_id(item_2_slab(it)->sid);
+}
+
+static void item_acquire_refcount(struct shard *s, struct item *it) {
+	assert(shard_locked(s));
 	assert(it->magic == ITEM_MAGIC);
     it->refcount++;
     slab_acquire_refcount(item_2_slab(it));
 }
 
-static void item_release_refcount(struct item *it) {
-	assert(pthread_mutex_trylock(&cache_lock) != 0);
+static void item_release_refcount(struct shard *s, struct item *it) {
+	assert(shard_locked(s));
 	assert(it->magic == ITEM_MAGIC);
 	assert(it->refcount > 0);
     it->refcount--;
     slab_release_refcount(item_2_slab(it));
 }
 
-void item_hdr_init(struct item *it, uint32_t offset, uint8_t id) {
-	assert(offset >= SLAB_HDR_SIZE && offset < settings.slab_size);
+void item_hdr_init(struct item *it, uint8_t id) {
+#ifndef NDEBUG
     it->magic = ITEM_MAGIC;
-    it->offset = offset;
+#endif
     it->id = id;
     it->refcount = 0;
     it->flags = 0;
+    it->accessed = 0;
+    item_wheel_clear(it);
+}
+
+//the lru queue, or under EVICT_SLRU the probation or protected queue, an item sits on
+static struct item_tqh *item_q(struct shard *s, struct item *it, uint32_t **nq) {
+    if (item_is_protected(it)) {
+        *nq = &s->item_nprotq[it->id];
+        return &s->item_protq[it->id];
+    }
+    *nq = &s->item_nlruq[it->id];
+    return &s->item_lruq[it->id];
+}
+
+//a full protected queue hands its oldest item back to probation
+static void item_demote(struct shard *s, uint8_t id) {
+    struct item *it;
+    uint64_t n = (uint64_t)s->item_nlruq[id] + s->item_nprotq[id];
+    while ((uint64_t)s->item_nprotq[id] * 100 > n * ITEM_PROTECTED_PERCENT) {
+        it = ITEMQ_FIRST(&s->item_protq[id]);
+        ITEMQ_REMOVE(&s->item_protq[id], it, i_tqe);
+        s->item_nprotq[id]--;
+        it->flags &= ~ITEM_PROTECTED;
+        ITEMQ_INSERT_TAIL(&s->item_lruq[id], it, i_tqe);
+        s->item_nlruq[id]++;
+    }
 }
 
-static void item_link_q(struct item *it, bool allocated) {
+static void item_link_q(struct shard *s, struct item *it, bool allocated) {
+    struct item_tqh *q;
+    uint32_t *nq;
     uint8_t id = it->id;
     assert(id >= SLABCLASS_MIN_ID && id <= SLABCLASS_MAX_ID);
     assert(it->magic == ITEM_MAGIC);
     assert(!item_is_slabbed(it));
     it->atime = time_now();
-    TAILQ_INSERT_TAIL(&item_lruq[id], it, i_tqe);
-    slab_lruq_touch(item_2_slab(it), allocated);
+    q = item_q(s, it, &nq);
+    ITEMQ_INSERT_TAIL(q, it, i_tqe);
+    (*nq)++;
+    if (item_is_protected(it)) {
+        item_demote(s, id);
+    }
+    slab_lruq_touch(s, item_2_slab(it), allocated);
 }
 
-static void item_unlink_q(struct item *it) {
-    uint8_t id = it->id;
-    assert(id >= SLABCLASS_MIN_ID && id <= SLABCLASS_MAX_ID);
+static void item_unlink_q(struct shard *s, struct item *it) {
+    struct item_tqh *q;
+    uint32_t *nq;
+    assert(it->id >= SLABCLASS_MIN_ID && it->id <= SLABCLASS_MAX_ID);
     assert(it->magic == ITEM_MAGIC);
-    TAILQ_REMOVE(&item_lruq[id], it, i_tqe);
+    q = item_q(s, it, &nq);
+    ITEMQ_REMOVE(q, it, i_tqe);
+    (*nq)--;
+    it->flags &= ~ITEM_PROTECTED;
 }
 
-void item_reuse(struct item *it) {
-	assert(pthread_mutex_trylock(&cache_lock) != 0);
+void item_reuse(struct shard *s, struct item *it) {
+	assert(shard_locked(s));
 	assert(it->magic == ITEM_MAGIC);
 	assert(!item_is_slabbed(it));
 	assert(item_is_linked(it));
 	assert(it->refcount == 0);
     it->flags &= ~ITEM_LINKED;
-    assoc_delete(item_key(it), it->nkey);
-    item_unlink_q(it);
+    item_2_slab(it)->nlive--;
+    assoc_delete(s, it);
+    item_unlink_q(s, it);
+    item_wheel_unlink(s, it);
+}
+
+//park a dead item until no lock free reader can still see it
+static void item_retire(struct shard *s, struct item *it) {
+    assert(shard_locked(s));
+    assert(!item_is_linked(it));
+    assert(!item_is_retired(it));
+    it->flags |= ITEM_RETIRED;
+    it->atime = (int)(uint32_t)epoch_now();
+    ITEMQ_INSERT_TAIL(&s->item_limboq, it, i_tqe);
+    s->nlimbo++;
+}
+
+void item_unretire(struct shard *s, struct item *it) {
+    assert(shard_locked(s));
+    assert(item_is_retired(it));
+    assert(s->nlimbo > 0);
+    it->flags &= ~ITEM_RETIRED;
+    ITEMQ_REMOVE(&s->item_limboq, it, i_tqe);
+    s->nlimbo--;
 }
 
-static struct item* item_get_from_lruq(uint8_t id) {
+//chunks come from the largest class, each holds this much of a chained value
+static uint32_t item_chunk_size(void) {
+    return (uint32_t)(slab_item_size(slabclass_max_id) - ITEM_HDR_SIZE);
+}
+
+static uint32_t item_nchunk(uint32_t nbyte) {
+    return (uint32_t)(((uint64_t)nbyte + item_chunk_size() - 1) / item_chunk_size());
+}
+
+//the head's value area is the table of its chunks by ref, which may be unaligned
+static struct item *item_chunk(struct item *it, uint32_t i) {
+    uint32_t ref;
+    memcpy(&ref, it->end + it->nkey + i * sizeof(ref), sizeof(ref));
+    return item_deref(ref);
+}
+
+static void item_chunk_set(struct item *it, uint32_t i, struct item *c) {
+    uint32_t ref = item_ref(c);
+    memcpy(it->end + it->nkey + i * sizeof(ref), &ref, sizeof(ref));
+}
+
+//a chunk pins its slab for as long as a head owns it
+static void item_chunk_put(struct shard *s, struct item *c) {
+    assert(item_is_chunk(c));
+    slab_release_refcount(item_2_slab(c));
+    c->flags &= ~ITEM_CHUNK;
+    slab_put_item(s, c);
+}
+
+//give back the chunks of a head whose slot is being reused, retired if readers may still be on them
+void item_unchain(struct shard *s, struct item *it, bool retire) {
+    struct item *c;
+    uint32_t i, n;
+    if (!item_is_chained(it)) {
+        return;
+    }
+    for (i = 0, n = item_nchunk(it->nbyte); i < n; i++) {
+        c = item_chunk(it, i);
+        if (retire) {
+            item_retire(s, c);
+        } else {
+            item_chunk_put(s, c);
+        }
+    }
+    it->flags &= ~ITEM_CHAINED;
+}
+
+void item_reclaim(struct shard *s) {
     struct item *it;
+    uint64_t safe;
+    if (s->nlimbo == 0) {
+        return;
+    }
+    epoch_advance();
+    safe = epoch_safe();
+    while ((it = ITEMQ_FIRST(&s->item_limboq)) != NULL && epoch_widen((uint32_t)it->atime) < safe) {
+        item_unretire(s, it);
+        if (item_is_chunk(it)) {
+            item_chunk_put(s, it);
+            continue;
+        }
+        item_unchain(s, it, false);
+        slab_put_item(s, it);
+    }
+}
+
+//unlink a victim, handing it back only if it can be overwritten right away
+static struct item* item_evict(struct shard *s, struct item *it) {
+    item_reuse(s, it);
+    if (settings.lockfree_read) {
+        item_retire(s, it);
+        return NULL;
+    }
+    item_unchain(s, it, false);
+    return it;
+}
+
+//the clock hand, referenced items lose their bit and go round again
+static struct item* item_get_from_clock(struct item_tqh *q) {
+    struct item *it, *next;
     struct item *uit;
     uint32_t tries;
-    if (!settings.use_lruq) {
-        return NULL;
+    for (tries = ITEM_LRUQ_MAX_TRIES, it = ITEMQ_FIRST(q), uit = NULL;
+	it != NULL && tries > 0; tries--, it = next) {
+        next = ITEMQ_NEXT(it, i_tqe);
+        if (it->refcount != 0) {
+            continue;
+        }
+        if (item_expired(it) || !__atomic_load_n(&it->accessed, __ATOMIC_RELAXED)) {
+            return it;
+        }
+        __atomic_store_n(&it->accessed, 0, __ATOMIC_RELAXED);
+        ITEMQ_REMOVE(q, it, i_tqe);
+        ITEMQ_INSERT_TAIL(q, it, i_tqe);
+        if (uit == NULL) {
+            uit = it;
+        }
     }
-    for (tries = ITEM_LRUQ_MAX_TRIES, it = TAILQ_FIRST(&item_lruq[id]), uit = NULL;
-	it != NULL && tries > 0; tries--, it = TAILQ_NEXT(it, i_tqe)) {
+    //every item swept was referenced, the first has used up its second chance
+    return uit;
+}
+
+static struct item* item_get_from_q(struct item_tqh *q) {
+    struct item *it;
+    struct item *uit;
+    uint32_t tries;
+    for (tries = ITEM_LRUQ_MAX_TRIES, it = ITEMQ_FIRST(q), uit = NULL;
+	it != NULL && tries > 0; tries--, it = ITEMQ_NEXT(it, i_tqe)) {
         if (it->refcount != 0) {
             continue;
         }
@@ -113,6 +388,22 @@ static struct item* item_get_from_lruq(uint8_t id) {
     return uit;
 }
 
+//under EVICT_SLRU victims come from probation, and from protected only once it runs dry
+static struct item* item_get_from_lruq(struct shard *s, uint8_t id) {
+    struct item *it;
+    if (!settings.use_lruq) {
+        return NULL;
+    }
+    if (settings.evict_opt & EVICT_CLOCK) {
+        return item_get_from_clock(&s->item_lruq[id]);
+    }
+    it = item_get_from_q(&s->item_lruq[id]);
+    if (it == NULL && (settings.evict_opt & EVICT_SLRU)) {
+        it = item_get_from_q(&s->item_protq[id]);
+    }
+    return it;
+}
+
 uint8_t item_slabid(uint16_t nkey, uint32_t nbyte) {
     size_t ntotal;
     uint8_t id;
@@ -121,153 +412,903 @@ uint8_t item_slabid(uint16_t nkey, uint32_t nbyte) {
     return id;
 }
 
-static struct item* _item_alloc(uint8_t id, char *key, uint16_t nkey, int exptime, char *value, uint32_t nbyte) {
+//largest value a put can store, as a chain whose table fills the largest class
+uint32_t item_max_nbyte(void) {
+    uint64_t n = (slab_item_size(slabclass_max_id) - ITEM_HDR_SIZE - 1) / sizeof(uint32_t) * item_chunk_size();
+    return n > UINT32_MAX ? UINT32_MAX : (uint32_t)n;
+}
+
+//class of the head of a value too big for any class, invalid if even its chunk table is
+uint8_t item_chain_slabid(uint16_t nkey, uint32_t nbyte) {
+    size_t ntotal;
+    ntotal = item_ntotal(nkey, item_nchunk(nbyte) * sizeof(uint32_t));
+    return ntotal > nbyte + ITEM_HDR_SIZE + nkey ? SLABCLASS_INVALID_ID : slab_id(ntotal);
+}
+
+static void item_set(struct item *it, char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, char *value, uint32_t nbyte) {
+    int64_t now = time_now_ms();
+    assert(!item_is_linked(it));
+    assert(!item_is_slabbed(it));
+    assert(!item_is_retired(it));
+    assert(it->refcount == 0);
+    it->flags = 0;
+    it->accessed = 0;
+    item_wheel_clear(it);
+    it->hv = hv;
+    it->nbyte = nbyte;
+    it->exptime = ttl_ms < ITEM_EXPTIME_MAX - now ? now + ttl_ms : ITEM_EXPTIME_MAX;
+    it->nkey = nkey;
+    //a chunk has no key
+    if (nkey > 0) {
+        memcpy(item_key(it), key, nkey);
+    }
+    //a reserved item gets its value from the caller later
+    if (value != NULL) {
+        memcpy(item_key(it) + nkey, value, nbyte);
+    }
+}
+
+//a put colder than its victim is refused, unless it updates a key already stored
+static bool item_admit(struct shard *s, char *key, uint16_t nkey, uint32_t hv, struct item *uit) {
+    if (!settings.use_admit || key == NULL) {
+        return true;
+    }
+    return admit_allow(hv, uit->hv) || assoc_find(s, key, nkey, hv) != NULL;
+}
+
+static struct item* _item_alloc(struct shard *s, uint8_t id, char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, char *value, uint32_t nbyte,
+                                bool *refused) {
     struct item *it;
     struct item *uit;
     assert(id >= SLABCLASS_MIN_ID && id <= SLABCLASS_MAX_ID);
-    it = item_get_from_lruq(id);
+    if (settings.lockfree_read && s->nlimbo >= ITEM_LIMBO_RECLAIM) {
+        item_reclaim(s);
+    }
+    it = item_get_from_lruq(s, id);
     if (it != NULL && item_expired(it)) {
-        item_reuse(it);
-        goto done;
+        if ((it = item_evict(s, it)) != NULL) {
+            goto done;
+        }
     }
-    uit = (settings.evict_opt & EVICT_LRU)? it : NULL;
-    it = slab_get_item(id);
+    uit = (settings.evict_opt & (EVICT_LRU | EVICT_SLRU | EVICT_CLOCK))? it : NULL;
+    it = slab_get_item(s, id);
     if (it != NULL) {
         goto done;
     }
-    if (uit != NULL) {
-        it = uit;
-        item_reuse(it);
-        goto done;
+    //slab_get_item may have evicted the slab uit lives in
+    if (uit != NULL && item_is_linked(uit)) {
+        if (!item_admit(s, key, nkey, hv, uit)) {
+            *refused = true;
+            return NULL;
+        }
+        s->pressure[id].nevict++;
+        if ((it = item_evict(s, uit)) != NULL) {
+            goto done;
+        }
+    }
+    if (settings.lockfree_read) {
+        item_reclaim(s);
+        it = slab_get_item(s, id);
+        if (it != NULL) {
+            goto done;
+        }
     }
+    s->pressure[id].nfail++;
     return NULL;
 done:
     assert(it->id == id);
-    assert(!item_is_linked(it));
-    assert(!item_is_slabbed(it));
-    assert(it->offset != 0);
-    assert(it->refcount == 0);
-    it->flags = 0;
-    it->nbyte = nbyte;
-    it->exptime = exptime + time_now();
-    it->nkey = nkey;
-    memcpy(item_key(it), key, nkey);
-    memcpy(item_key(it) + nkey, value, nbyte);
+    item_set(it, key, nkey, hv, ttl_ms, value, nbyte);
     return it;
 }
 
-static void item_free(struct item *it) {
+static void item_free(struct shard *s, struct item *it) {
 	assert(it->magic == ITEM_MAGIC);
-    slab_put_item(it);
+    if (settings.lockfree_read) {
+        item_retire(s, it);
+        return;
+    }
+    item_unchain(s, it, false);
+    slab_put_item(s, it);
 }
 
-static void _item_link(struct item *it) {
+static void _item_link(struct shard *s, struct item *it) {
 	assert(it->magic == ITEM_MAGIC);
 	assert(!item_is_linked(it));
 	assert(!item_is_slabbed(it));
     it->flags |= ITEM_LINKED;
-    assoc_insert(it);
-    item_link_q(it, true);
+    item_2_slab(it)->nlive++;
+    assoc_insert(s, it);
+    item_link_q(s, it, true);
+    item_wheel_link(s, it);
+}
+
+//check an item found in a reattached heap and rebase its times, true if it is still live
+bool item_recover(struct shard *s, struct item *it, uint8_t id, int delta) {
+    int now = (int)(time(NULL) - time_started());
+    int64_t at;
+#ifndef NDEBUG
+    if (it->magic != ITEM_MAGIC) {
+        return false;
+    }
+#endif
+    if (it->id != id) {
+        return false;
+    }
+    if ((it->flags & ~(ITEM_RALIGN | ITEM_PROTECTED | ITEM_CHAINED)) != ITEM_LINKED || it->nkey == 0) {
+        return false;
+    }
+    //a chained head holds its chunk table, checked by item_recover_chain
+    if (item_ntotal(it->nkey, item_is_chained(it) ? item_nchunk(it->nbyte) * sizeof(uint32_t) : it->nbyte) >
+        slab_item_size(id) || shard_get(it->hv) != s) {
+        return false;
+    }
+    if (it->exptime > 0) {
+        at = (int64_t)it->exptime + (int64_t)delta * 1000;
+        if (at <= (int64_t)now * 1000) {
+            return false;
+        }
+        it->exptime = at;
+    }
+    it->atime += delta;
+    it->refcount = 0;
+    it->accessed = 0;
+    item_wheel_clear(it);
+    it->flags &= ~(ITEM_LINKED | ITEM_PROTECTED);
+    return true;
+}
+
+//a chunk found in a reattached heap, kept unclaimed until a head takes it
+bool item_recover_chunk(struct item *it, uint8_t id) {
+#ifndef NDEBUG
+    if (it->magic != ITEM_MAGIC) {
+        return false;
+    }
+#endif
+    if (it->id != id || id != slabclass_max_id || it->flags != ITEM_CHUNK || it->nbyte > item_chunk_size()) {
+        return false;
+    }
+    it->refcount = 0;
+    it->accessed = 0;
+    return true;
 }
 
-static void _item_unlink(struct item *it) {
+//a recovered head keeps its value only if every ref names an unclaimed chunk of this shard,
+//claimed chunks pin their slabs again and are marked through accessed until item_recover_orphan
+bool item_recover_chain(struct shard *s, struct item *it) {
+    struct item *c;
+    uint32_t i, j, n, size = item_chunk_size();
+    if (!item_is_chained(it)) {
+        return true;
+    }
+    for (i = 0, n = item_nchunk(it->nbyte); i < n; i++) {
+        c = item_chunk(it, i);
+        if (c == NULL || !slab_recovered_item(s, c, slabclass_max_id) || !item_is_chunk(c) || c->accessed != 0 ||
+            c->nbyte != (i + 1 < n ? size : it->nbyte - i * size)) {
+            break;
+        }
+        c->accessed = 1;
+    }
+    for (j = 0; j < i; j++) {
+        c = item_chunk(it, j);
+        if (i == n) {
+            slab_acquire_refcount(item_2_slab(c));
+        } else {
+            c->accessed = 0;
+        }
+    }
+    if (i < n) {
+        it->flags &= ~ITEM_CHAINED;
+        return false;
+    }
+    return true;
+}
+
+//true for a chunk no recovered head claimed, which then goes back to the slab
+bool item_recover_orphan(struct item *it) {
+    if (!item_is_chunk(it)) {
+        return false;
+    }
+    if (it->accessed != 0) {
+        it->accessed = 0;
+        return false;
+    }
+    return true;
+}
+
+//link a recovered item again, false if its key is already taken
+bool item_relink(struct shard *s, struct item *it) {
+    assert(shard_locked(s));
+    if (assoc_find(s, item_key(it), it->nkey, it->hv) != NULL) {
+        return false;
+    }
+    _item_link(s, it);
+    return true;
+}
+
+static void _item_unlink(struct shard *s, struct item *it) {
 	assert(it->magic == ITEM_MAGIC);
 	assert(item_is_linked(it));
     if (item_is_linked(it)) {
         it->flags &= ~ITEM_LINKED;
-        assoc_delete(item_key(it), it->nkey);
-        item_unlink_q(it);
+        item_2_slab(it)->nlive--;
+        assoc_delete(s, it);
+        item_unlink_q(s, it);
+        item_wheel_unlink(s, it);
         if (it->refcount == 0) {
-            item_free(it);
+            item_free(s, it);
         }
     }
 }
 
-static void _item_remove(struct item *it) {
+static void _item_remove(struct shard *s, struct item *it) {
 	assert(it->magic == ITEM_MAGIC);
 	assert(!item_is_slabbed(it));
     if (it->refcount != 0) {
-        item_release_refcount(it);
+        item_release_refcount(s, it);
     }
     if (it->refcount == 0 && !item_is_linked(it)) {
-        item_free(it);
+        item_free(s, it);
     }
 }
 
 void item_remove(struct item *it) {
-    pthread_mutex_lock(&cache_lock);
-    _item_remove(it);
-    pthread_mutex_unlock(&cache_lock);
+    struct shard *s;
+    if (settings.lockfree_read) {
+        epoch_exit();
+        return;
+    }
+    s = item_2_shard(it);
+    pthread_mutex_lock(&s->lock);
+    _item_remove(s, it);
+    pthread_mutex_unlock(&s->lock);
+}
+
+//keep a linked item readable after the shard lock is dropped, both under the lock
+void item_pin(struct shard *s, struct item *it) {
+    item_acquire_refcount(s, it);
+}
+
+void item_unpin(struct shard *s, struct item *it) {
+    _item_remove(s, it);
 }
 
 void item_delete(struct item *it) {
-    pthread_mutex_lock(&cache_lock);
-    _item_unlink(it);
-    _item_remove(it);
-    pthread_mutex_unlock(&cache_lock);
+    struct shard *s = item_2_shard(it);
+    if (settings.lockfree_read) {
+        pthread_mutex_lock(&s->lock);
+        if (item_is_linked(it)) {
+            _item_unlink(s, it);
+        }
+        pthread_mutex_unlock(&s->lock);
+        epoch_exit();
+        return;
+    }
+    pthread_mutex_lock(&s->lock);
+    _item_unlink(s, it);
+    _item_remove(s, it);
+    pthread_mutex_unlock(&s->lock);
+}
+
+//a hit on a probation item promotes it however recent it is
+static bool item_touch_due(struct item *it) {
+    return it->atime < (time_now() - ITEM_UPDATE_INTERVAL) ||
+        ((settings.evict_opt & EVICT_SLRU) && !item_is_protected(it));
+}
+
+//under EVICT_CLOCK a read only sets the reference bit, the eviction hand does the rest
+static bool item_mark(struct item *it) {
+    if (!(settings.evict_opt & EVICT_CLOCK)) {
+        return false;
+    }
+    if (!__atomic_load_n(&it->accessed, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&it->accessed, 1, __ATOMIC_RELAXED);
+    }
+    return true;
 }
 
-static void _item_touch(struct item *it) {
+static void _item_touch(struct shard *s, struct item *it) {
 	assert(it->magic == ITEM_MAGIC);
 	assert(!item_is_slabbed(it));
-    if (it->atime >= (time_now() - ITEM_UPDATE_INTERVAL)) {
+    if (item_mark(it) || !item_touch_due(it)) {
         return;
     }
     assert(item_is_linked(it));
-    item_unlink_q(it);
-    item_link_q(it, false);
+    item_unlink_q(s, it);
+    if (settings.evict_opt & EVICT_SLRU) {
+        it->flags |= ITEM_PROTECTED;
+    }
+    item_link_q(s, it, false);
 }
 
 void item_touch(struct item *it) {
-    if (it->atime >= (time_now() - ITEM_UPDATE_INTERVAL)) {
+    struct shard *s;
+    if (item_mark(it) || !item_touch_due(it)) {
         return;
     }
-    pthread_mutex_lock(&cache_lock);
-    _item_touch(it);
-    pthread_mutex_unlock(&cache_lock);
+    s = item_2_shard(it);
+    pthread_mutex_lock(&s->lock);
+    _item_touch(s, it);
+    pthread_mutex_unlock(&s->lock);
 }
 
-static void _item_replace(struct item *it, struct item *nit) {
+static void _item_replace(struct shard *s, struct item *it, struct item *nit) {
     assert(it->magic == ITEM_MAGIC);
     assert(!item_is_slabbed(it));
     assert(nit->magic == ITEM_MAGIC);
     assert(!item_is_slabbed(nit));
-    _item_unlink(it);
-    _item_link(nit);
+    _item_unlink(s, it);
+    _item_link(s, nit);
 }
 
-static struct item* _item_get(const char *key, uint16_t nkey) {
+//copy a live item into the free slot nit, which takes its place in the index and the lru
+void item_move(struct shard *s, struct item *it, struct item *nit) {
+    struct item_tqh *q;
+    uint32_t *nq;
+    assert(shard_locked(s));
+    assert(item_is_linked(it));
+    assert(it->refcount == 0);
+    assert(nit->id == it->id);
+    assert(nit->refcount == 0);
+    nit->hv = it->hv;
+    nit->atime = it->atime;
+    nit->exptime = it->exptime;
+    nit->nbyte = it->nbyte;
+    nit->nkey = it->nkey;
+    nit->flags = it->flags;
+    nit->accessed = it->accessed;
+    memcpy(nit->end, it->end, slab_item_size(it->id) - ITEM_HDR_SIZE);
+    item_2_slab(nit)->nlive++;
+    q = item_q(s, it, &nq);
+    ITEMQ_INSERT_AFTER(q, it, nit, i_tqe);
+    (*nq)++;
+    item_wheel_move(s, it, nit);
+    //any chunks now belong to nit
+    it->flags &= ~(ITEM_LINKED | ITEM_CHAINED);
+    item_2_slab(it)->nlive--;
+    assoc_delete(s, it);
+    assoc_insert(s, nit);
+    item_unlink_q(s, it);
+    //the old slot is left for the caller, lock free readers may still be on it
+    if (settings.lockfree_read) {
+        item_retire(s, it);
+    }
+}
+
+//apply the touches this thread buffered for s, skipping items unlinked since
+static void item_readbuf_drain(struct shard *s) {
+    struct item_readbuf *rb;
+    uint32_t i;
+    if (s->id >= nreadbuf || readbufs[s->id].n == 0) {
+        return;
+    }
+    rb = &readbufs[s->id];
+    for (i = 0; i < rb->n; i++) {
+        if (assoc_contains(s, rb->its[i], rb->hvs[i])) {
+            _item_touch(s, rb->its[i]);
+        }
+    }
+    rb->n = 0;
+}
+
+//a full buffer is applied if the lock is free right now and dropped otherwise
+static void item_readbuf_push(struct shard *s, struct item *it) {
+    struct item_readbuf *rb;
+    //a restarted cache may have more shards, what was buffered is dropped
+    if (nreadbuf != nshard) {
+        free(readbufs);
+        nreadbuf = 0;
+        readbufs = calloc(nshard, sizeof(*readbufs));
+        pthread_setspecific(readbuf_key, readbufs);
+        if (readbufs == NULL) {
+            return;
+        }
+        nreadbuf = nshard;
+    }
+    rb = &readbufs[s->id];
+    if (rb->n > 0 && rb->its[rb->n - 1] == it) {
+        return;
+    }
+    if (rb->n == ITEM_READBUF_SIZE) {
+        if (pthread_mutex_trylock(&s->lock) == 0) {
+            item_readbuf_drain(s);
+            pthread_mutex_unlock(&s->lock);
+        }
+        rb->n = 0;
+    }
+    rb->its[rb->n] = it;
+    rb->hvs[rb->n] = it->hv;
+    rb->n++;
+}
+
+static struct item* _item_get(struct shard *s, const char *key, uint16_t nkey, uint32_t hv) {
     struct item *it;
-    it = assoc_find(key, nkey);
+    it = assoc_find(s, key, nkey, hv);
     if (it == NULL) return NULL;
-    if (it->exptime != 0 && it->exptime <= time_now()) {
-        _item_unlink(it);
+    if (it->exptime != 0 && (int64_t)it->exptime <= time_now_ms()) {
+        _item_unlink(s, it);
         return NULL;
     }
-    item_acquire_refcount(it);
-    _item_touch(it);
+    item_acquire_refcount(s, it);
+    _item_touch(s, it);
     return it;
 }
 
-struct item* item_get(const char *key, uint16_t nkey) {
+//link a filled item, replacing any item under the same key
+static void _item_publish(struct shard *s, struct item *it) {
+    struct item *oit;
+    if (settings.profile_sample != 0 && it->hv % settings.profile_sample == 0 && !item_is_chained(it)) {
+        slab_profile_sample(item_size(it));
+    }
+    oit = _item_get(s, item_key(it), it->nkey, it->hv);
+    if (oit != NULL) {
+        _item_replace(s, oit, it);
+        _item_remove(s, oit);
+    } else {
+        _item_link(s, it);
+    }
+}
+
+//the epoch entered here is left by item_remove
+static struct item* item_get_nolock(struct shard *s, const char *key, uint16_t nkey, uint32_t hv) {
     struct item *it;
-    pthread_mutex_lock(&cache_lock);
-    it = _item_get(key, nkey);
-    pthread_mutex_unlock(&cache_lock);
+    epoch_enter();
+    it = assoc_find_nolock(s, key, nkey, hv);
+    if (it == NULL || (it->exptime != 0 && (int64_t)it->exptime <= time_now_ms())) {
+        epoch_exit();
+        return NULL;
+    }
+    if (item_mark(it) || !item_touch_due(it)) {
+        return it;
+    }
+    if (settings.use_readbuf) {
+        item_readbuf_push(s, it);
+    } else if (pthread_mutex_trylock(&s->lock) == 0) {
+        if (item_is_linked(it)) {
+            _item_touch(s, it);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
     return it;
 }
 
-struct item *item_alloc(uint8_t id, char *key, uint16_t nkey, int exptime, char *value, uint32_t nbyte) {
-    struct item *it, *oit;
-    pthread_mutex_lock(&cache_lock);
-    it = _item_alloc(id, key, nkey, exptime, value, nbyte);
-    if (it == NULL) return NULL;
-    oit = _item_get(key, nkey);
-    if (oit != NULL) _item_replace(oit, it);
-    else {
-    	_item_link(it);
+struct item* item_get(const char *key, uint16_t nkey, uint32_t hv) {
+    struct item *it;
+    struct shard *s = shard_get(hv);
+    if (settings.use_admit) {
+        admit_record(hv);
+    }
+    if (settings.lockfree_read) {
+        return item_get_nolock(s, key, nkey, hv);
+    }
+    pthread_mutex_lock(&s->lock);
+    it = _item_get(s, key, nkey, hv);
+    pthread_mutex_unlock(&s->lock);
+    return it;
+}
+
+//_item_alloc that waits out lock free readers when every victim is retired, unless we are one
+static struct item *item_alloc_locked(struct shard *s, uint8_t id, char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, char *value, uint32_t nbyte) {
+    struct item *it;
+    uint32_t tries;
+    bool refused = false;
+    item_readbuf_drain(s);
+    it = _item_alloc(s, id, key, nkey, hv, ttl_ms, value, nbyte, &refused);
+    for (tries = 0; it == NULL && !refused && settings.lockfree_read && !epoch_entered() && tries < ITEM_SYNC_MAX_TRIES; tries++) {
+        pthread_mutex_unlock(&s->lock);
+        epoch_synchronize();
+        pthread_mutex_lock(&s->lock);
+        it = _item_alloc(s, id, key, nkey, hv, ttl_ms, value, nbyte, &refused);
+    }
+    return it;
+}
+
+struct item *item_alloc(uint8_t id, char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, char *value, uint32_t nbyte) {
+    struct item *it;
+    struct shard *s = shard_get(hv);
+    //a magazine item is private to us, fill it before taking the lock
+    it = settings.use_magazine ? slab_magazine_get(s, id) : NULL;
+    if (it != NULL) {
+        item_set(it, key, nkey, hv, ttl_ms, value, nbyte);
+        pthread_mutex_lock(&s->lock);
+        slab_release_refcount(item_2_slab(it));
+        goto link;
+    }
+    pthread_mutex_lock(&s->lock);
+    it = item_alloc_locked(s, id, key, nkey, hv, ttl_ms, value, nbyte);
+    if (it == NULL) {
+        pthread_mutex_unlock(&s->lock);
+        return NULL;
+    }
+link:
+    _item_publish(s, it);
+    pthread_mutex_unlock(&s->lock);
+    return it;
+}
+
+//an unlinked item pinned for the caller to fill, readers cannot see it until item_commit
+struct item *item_reserve(uint8_t id, char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, uint32_t nbyte) {
+    struct item *it;
+    struct shard *s = shard_get(hv);
+    it = settings.use_magazine ? slab_magazine_get(s, id) : NULL;
+    if (it != NULL) {
+        //the magazine's pin on the slab becomes the reservation's
+        item_set(it, key, nkey, hv, ttl_ms, NULL, nbyte);
+        it->refcount = 1;
+        return it;
+    }
+    pthread_mutex_lock(&s->lock);
+    it = item_alloc_locked(s, id, key, nkey, hv, ttl_ms, NULL, nbyte);
+    if (it != NULL) {
+        item_acquire_refcount(s, it);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return it;
+}
+
+void item_commit(struct item *it) {
+    struct shard *s = item_2_shard(it);
+    assert(!item_is_linked(it));
+    assert(it->refcount == 1);
+    pthread_mutex_lock(&s->lock);
+    _item_publish(s, it);
+    item_release_refcount(s, it);
+    pthread_mutex_unlock(&s->lock);
+}
+
+//never visible to a reader, so it goes straight back to the slab
+void item_abort(struct item *it) {
+    struct shard *s = item_2_shard(it);
+    assert(!item_is_linked(it));
+    assert(it->refcount == 1);
+    pthread_mutex_lock(&s->lock);
+    item_release_refcount(s, it);
+    item_unchain(s, it, false);
+    slab_put_item(s, it);
+    pthread_mutex_unlock(&s->lock);
+}
+
+//the head holds the key and a table of chunks, pinned like a reserved item until item_commit
+struct item *item_reserve_chain(uint8_t id, char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, uint32_t nbyte) {
+    struct item *it, *c;
+    struct shard *s = shard_get(hv);
+    uint32_t i, n = item_nchunk(nbyte), size = item_chunk_size();
+    pthread_mutex_lock(&s->lock);
+    it = item_alloc_locked(s, id, key, nkey, hv, ttl_ms, NULL, n * sizeof(uint32_t));
+    if (it == NULL) {
+        pthread_mutex_unlock(&s->lock);
+        return NULL;
+    }
+    item_acquire_refcount(s, it);
+    for (i = 0; i < n; i++) {
+        c = item_alloc_locked(s, slabclass_max_id, NULL, 0, 0, 0, NULL, i + 1 < n ? size : nbyte - i * size);
+        if (c == NULL) {
+            break;
+        }
+        slab_acquire_refcount(item_2_slab(c));
+        c->flags |= ITEM_CHUNK;
+        item_chunk_set(it, i, c);
+    }
+    //the table only counts the chunks we got
+    it->nbyte = i * size;
+    it->flags |= ITEM_CHAINED;
+    if (i < n) {
+        item_release_refcount(s, it);
+        item_unchain(s, it, false);
+        slab_put_item(s, it);
+        it = NULL;
+    } else {
+        it->nbyte = nbyte;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return it;
+}
+
+//copies the value outside the lock, the chunks are private until the commit
+struct item *item_alloc_chain(uint8_t id, char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, char *value, uint32_t nbyte) {
+    struct item *it, *c;
+    uint32_t i, n;
+    it = item_reserve_chain(id, key, nkey, hv, ttl_ms, nbyte);
+    if (it == NULL) {
+        return NULL;
+    }
+    for (i = 0, n = item_nchunk(nbyte); i < n; i++) {
+        c = item_chunk(it, i);
+        memcpy(c->end, value, c->nbyte);
+        value += c->nbyte;
+    }
+    item_commit(it);
+    return it;
+}
+
+//scatter list of a value, returns the entries it takes and fills at most niov of them
+uint32_t item_iov(struct item *it, struct iovec *iov, uint32_t niov) {
+    struct item *c;
+    uint32_t i, n;
+    if (!item_is_chained(it)) {
+        if (niov > 0) {
+            iov[0].iov_base = item_data(it);
+            iov[0].iov_len = it->nbyte;
+        }
+        return 1;
+    }
+    for (i = 0, n = item_nchunk(it->nbyte); i < n && i < niov; i++) {
+        c = item_chunk(it, i);
+        iov[i].iov_base = c->end;
+        iov[i].iov_len = c->nbyte;
+    }
+    return n;
+}
+
+//keys of a batch in the same shard as key i that are not done yet
+static bool item_batch_next(const uint32_t *hvs, const bool *done, uint32_t i, uint32_t j) {
+    return !done[j] && shard_get(hvs[j]) == shard_get(hvs[i]);
+}
+
+void item_mget(const char **keys, const uint16_t *nkeys, const uint32_t *hvs, uint32_t n, struct item **items) {
+    struct shard *s;
+    bool done[ITEM_BATCH_MAX];
+    uint32_t i, j;
+    assert(n <= ITEM_BATCH_MAX);
+    for (i = 0; i < n; i++) {
+        assoc_prefetch_bucket(shard_get(hvs[i]), hvs[i]);
+        if (settings.use_admit) {
+            admit_record(hvs[i]);
+        }
+    }
+    if (settings.lockfree_read) {
+        epoch_enter();
+        for (i = 0; i < n; i++) {
+            assoc_prefetch_item_nolock(shard_get(hvs[i]), hvs[i]);
+        }
+        for (i = 0; i < n; i++) {
+            items[i] = item_get_nolock(shard_get(hvs[i]), keys[i], nkeys[i], hvs[i]);
+        }
+        epoch_exit();
+        return;
+    }
+    memset(done, 0, sizeof(done));
+    //one lock hold per shard the batch touches
+    for (i = 0; i < n; i++) {
+        if (done[i]) {
+            continue;
+        }
+        s = shard_get(hvs[i]);
+        pthread_mutex_lock(&s->lock);
+        for (j = i; j < n; j++) {
+            if (item_batch_next(hvs, done, i, j)) {
+                assoc_prefetch_item(s, hvs[j]);
+            }
+        }
+        for (j = i; j < n; j++) {
+            if (item_batch_next(hvs, done, i, j)) {
+                items[j] = _item_get(s, keys[j], nkeys[j], hvs[j]);
+                done[j] = true;
+            }
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+uint32_t item_mput(char **keys, const uint16_t *nkeys, const uint32_t *hvs, const uint8_t *ids, int64_t ttl_ms,
+                   char **values, const uint32_t *nbytes, uint32_t n) {
+    struct item *its[ITEM_BATCH_MAX];
+    struct shard *s;
+    bool done[ITEM_BATCH_MAX], refused[ITEM_BATCH_MAX];
+    uint32_t i, j, nstored = 0;
+    assert(n <= ITEM_BATCH_MAX);
+    for (i = 0; i < n; i++) {
+        assoc_prefetch_bucket(shard_get(hvs[i]), hvs[i]);
+    }
+    //magazine items are private to us, fill them before taking any lock
+    for (i = 0; i < n; i++) {
+        its[i] = settings.use_magazine ? slab_magazine_get(shard_get(hvs[i]), ids[i]) : NULL;
+        if (its[i] != NULL) {
+            item_set(its[i], keys[i], nkeys[i], hvs[i], ttl_ms, values[i], nbytes[i]);
+        }
+    }
+    memset(done, 0, sizeof(done));
+    memset(refused, 0, sizeof(refused));
+    for (i = 0; i < n; i++) {
+        if (done[i]) {
+            continue;
+        }
+        s = shard_get(hvs[i]);
+        pthread_mutex_lock(&s->lock);
+        for (j = i; j < n; j++) {
+            if (item_batch_next(hvs, done, i, j)) {
+                assoc_prefetch_item(s, hvs[j]);
+            }
+        }
+        //in batch order, so the last put of a repeated key wins
+        for (j = i; j < n; j++) {
+            if (!item_batch_next(hvs, done, i, j)) {
+                continue;
+            }
+            if (its[j] != NULL) {
+                slab_release_refcount(item_2_slab(its[j]));
+            } else {
+                its[j] = _item_alloc(s, ids[j], keys[j], nkeys[j], hvs[j], ttl_ms, values[j], nbytes[j], &refused[j]);
+            }
+            if (its[j] != NULL) {
+                _item_publish(s, its[j]);
+                nstored++;
+            }
+            done[j] = true;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    //puts that found no room retry alone, which may wait out lock free readers
+    for (i = 0; settings.lockfree_read && i < n; i++) {
+        if (its[i] == NULL && !refused[i] && item_alloc(ids[i], keys[i], nkeys[i], hvs[i], ttl_ms, values[i], nbytes[i]) != NULL) {
+            nstored++;
+        }
+    }
+    return nstored;
+}
+
+//slots an item and its chunks hold, what unlinking it hands back
+static uint64_t item_footprint(struct item *it) {
+    uint64_t n = slab_item_size(it->id);
+    if (item_is_chained(it)) {
+        n += (uint64_t)item_nchunk(it->nbyte) * slab_item_size(slabclass_max_id);
+    }
+    return n;
+}
+
+//unlink the expired items among the next ITEM_CRAWL_SLICE of q from it on, returns where to go on from
+static struct item *item_crawl_slice(struct shard *s, struct item_tqh *q, struct item *it, uint64_t *nbyte) {
+    struct item *next;
+    uint32_t n;
+    for (n = 0; it != NULL && n < ITEM_CRAWL_SLICE; n++, it = next) {
+        next = ITEMQ_NEXT(it, i_tqe);
+        if (item_expired(it)) {
+            *nbyte += item_footprint(it);
+            _item_unlink(s, it);
+        }
     }
-    if (oit != NULL) _item_remove(oit);
-    pthread_mutex_unlock(&cache_lock);
     return it;
 }
+
+//walk q oldest first, letting go of the lock between slices
+static void item_crawl_q(struct shard *s, struct item_tqh *q, uint64_t *nbyte) {
+    struct item *it;
+    uint32_t *nq;
+    uint32_t hv;
+    pthread_mutex_lock(&s->lock);
+    it = ITEMQ_FIRST(q);
+    for (;;) {
+        it = item_crawl_slice(s, q, it, nbyte);
+        if (it == NULL) {
+            break;
+        }
+        hv = it->hv;
+        pthread_mutex_unlock(&s->lock);
+        pthread_mutex_lock(&s->lock);
+        //the item we stopped at may be gone meanwhile, or touched onto another queue
+        if (!assoc_contains(s, it, hv) || item_q(s, it, &nq) != q) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void item_crawl_pass(void) {
+    struct shard *s;
+    uint64_t nbyte = 0;
+    uint32_t i;
+    uint8_t id;
+    for (i = 0; i < nshard; i++) {
+        s = &shards[i];
+        for (id = SLABCLASS_MIN_ID; id <= slabclass_max_id; id++) {
+            item_crawl_q(s, &s->item_lruq[id], &nbyte);
+            item_crawl_q(s, &s->item_protq[id], &nbyte);
+        }
+        if (settings.lockfree_read) {
+            pthread_mutex_lock(&s->lock);
+            item_reclaim(s);
+            pthread_mutex_unlock(&s->lock);
+        }
+    }
+    __atomic_store_n(&crawler.last_nbyte, nbyte, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&crawler.nbyte, nbyte, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&crawler.npass, 1, __ATOMIC_RELAXED);
+}
+
+static void *item_crawler_thread(void *arg) {
+    struct timespec ts;
+    ts.tv_sec = settings.crawl_ms / 1000;
+    ts.tv_nsec = (long)(settings.crawl_ms % 1000) * 1000000;
+    for (;;) {
+        nanosleep(&ts, NULL);
+        item_crawl_pass();
+    }
+    return NULL;
+}
+
+rstatus_t item_crawler_init(void) {
+    crawler.nbyte = 0;
+    crawler.last_nbyte = 0;
+    crawler.npass = 0;
+    if (settings.crawl_ms == 0) {
+        return MC_OK;
+    }
+    return pthread_create(&crawler.tid, NULL, item_crawler_thread, NULL) == 0 ? MC_OK : MC_ERROR;
+}
+
+//bytes reclaimed by every pass so far, and in *last by the latest one
+uint64_t item_crawler_nbyte(uint64_t *last) {
+    *last = __atomic_load_n(&crawler.last_nbyte, __ATOMIC_RELAXED);
+    return __atomic_load_n(&crawler.nbyte, __ATOMIC_RELAXED);
+}
+
+uint64_t item_crawler_npass(void) {
+    return __atomic_load_n(&crawler.npass, __ATOMIC_RELAXED);
+}
+
+#ifdef ITEM_WHEEL
+//empty a slot so that items put back into the same slot are not seen again
+static void item_wheel_cascade(struct shard *s, uint8_t slot) {
+    struct item_wheel *w = &s->wheel;
+    struct item_tqh l = w->slot[slot];
+    struct item *it;
+    ITEMQ_INIT(&w->slot[slot]);
+    while ((it = ITEMQ_FIRST(&l)) != NULL) {
+        ITEMQ_REMOVE(&l, it, w_tqe);
+        it->wslot = item_wheel_slot(w, item_exptime_sec(it));
+        ITEMQ_INSERT_TAIL(&w->slot[it->wslot], it, w_tqe);
+    }
+}
+
+//free the items of the second slot of w->time and move the wheel on by one second
+static void item_wheel_step(struct shard *s) {
+    struct item_wheel *w = &s->wheel;
+    struct item_tqh l;
+    struct item *it;
+    int t = w->time;
+    if (t % (ITEM_WHEEL_SEC * ITEM_WHEEL_MIN * ITEM_WHEEL_HOUR) == 0) {
+        item_wheel_cascade(s, ITEM_WHEEL_NSLOT - 1);
+    }
+    if (t % (ITEM_WHEEL_SEC * ITEM_WHEEL_MIN) == 0) {
+        item_wheel_cascade(s, ITEM_WHEEL_SEC + ITEM_WHEEL_MIN + t / (ITEM_WHEEL_SEC * ITEM_WHEEL_MIN) % ITEM_WHEEL_HOUR);
+    }
+    if (t % ITEM_WHEEL_SEC == 0) {
+        item_wheel_cascade(s, ITEM_WHEEL_SEC + t / ITEM_WHEEL_SEC % ITEM_WHEEL_MIN);
+    }
+    l = w->slot[t % ITEM_WHEEL_SEC];
+    ITEMQ_INIT(&w->slot[t % ITEM_WHEEL_SEC]);
+    while ((it = ITEMQ_FIRST(&l)) != NULL) {
+        assert(item_exptime_sec(it) <= t);
+        ITEMQ_REMOVE(&l, it, w_tqe);
+        it->wslot = ITEM_WHEEL_NONE;
+        _item_unlink(s, it);
+        __atomic_store_n(&w->nexpired, w->nexpired + 1, __ATOMIC_RELAXED);
+    }
+    w->time = t + 1;
+}
+
+//run from the clock thread, items with an exptime before now are expired
+void item_wheel_tick(int now) {
+    struct shard *s;
+    uint32_t i;
+    for (i = 0; i < nshard; i++) {
+        s = &shards[i];
+        pthread_mutex_lock(&s->lock);
+        while (s->wheel.time < now) {
+            item_wheel_step(s);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+#else
+void item_wheel_tick(int now) {
+}
+#endif
+
+uint64_t item_wheel_nexpired(void) {
+    uint64_t n = 0;
+    uint32_t i;
+    for (i = 0; i < nshard; i++) {
+        n += __atomic_load_n(&shards[i].wheel.nexpired, __ATOMIC_RELAXED);
+    }
+    return n;
+}
@@ -4,33 +4,156 @@
 #include "cache.h"
 
 #define ITEM_MAGIC 0xfeedface
+//most keys item_mget and item_mput take at once
+#define ITEM_BATCH_MAX 64
+//lru touches a thread buffers for one shard before it applies them
+#define ITEM_READBUF_SIZE 32
+//items the expiry crawler looks at per shard lock hold
+#define ITEM_CRAWL_SLICE 64
+//slots of each level of the timing wheel, in seconds, minutes and hours,
+//the wheel links are only in items built with ITEM_WHEEL
+#define ITEM_WHEEL_SEC 60
+#define ITEM_WHEEL_MIN 60
+#define ITEM_WHEEL_HOUR 24
+#define ITEM_WHEEL_NSLOT (ITEM_WHEEL_SEC + ITEM_WHEEL_MIN + ITEM_WHEEL_HOUR + 1)
+//wslot of an item on no wheel slot
+#define ITEM_WHEEL_NONE UCHAR_MAX
+//links are offsets from heap_base in units of 1 << item_ref_shift, the smallest that reaches
+//the end of the heap, so 8 bytes up to 32G, 16 up to 64G and 32 up to 128G
+#define ITEM_REF_MIN_SHIFT 3
+#define ITEM_REF_MAX_SHIFT 5
 
 typedef enum item_flags {
     ITEM_LINKED  = 1,
     ITEM_SLABBED = 2,
     ITEM_RALIGN  = 4,
+    ITEM_RETIRED = 8,
+    ITEM_CHAINED = 16,
+    ITEM_CHUNK   = 32,
+    ITEM_PROTECTED = 64,
 } item_flags_t;
 
+//a queue of items linked by ref, 0 ends it
+struct item_tqe {
+    uint32_t next;
+    uint32_t prev;
+};
+
+struct item_tqh {
+    uint32_t first;
+    uint32_t last;
+};
+
 struct item {
+    uint64_t          exptime:40; //ms since start the item expires at, 0 for never
+    uint64_t          refcount:16;
+    uint64_t          flags:8;
+#ifndef NDEBUG
     uint32_t          magic;
-    TAILQ_ENTRY(item) i_tqe;
-    SLIST_ENTRY(item) h_sle;
+#endif
+    uint32_t          hv;
+    struct item_tqe   i_tqe;
+#ifndef ASSOC_BUCKET
+    uint32_t          h_next;
+#endif
+#ifdef ITEM_WHEEL
+    struct item_tqe   w_tqe;
+#endif
     int               atime;
-    int               exptime;
     uint32_t          nbyte;
-    uint32_t          offset;
-    uint16_t          refcount;
-    uint8_t           flags;
-    uint8_t           id;
     uint16_t          nkey;
+    uint8_t           id;
+    uint8_t           accessed;
+#ifdef ITEM_WHEEL
+    uint8_t           wslot;
+#endif
     char              end[1];
 };
 
-SLIST_HEAD(item_slh, item);
-TAILQ_HEAD(item_tqh, item);
+//linked items by exptime, slots of seconds, then minutes, then hours, then the far slot,
+//a slot of a coarser level is spread over the finer one when its time comes
+struct item_wheel {
+    int             time; //items expiring before it are already freed
+    struct item_tqh slot[ITEM_WHEEL_NSLOT];
+    uint64_t        nexpired;
+};
+
+//start of the slab heap every item lives in and the unit of refs into it, set by slab_init
+extern uint8_t *heap_base;
+extern uint8_t item_ref_shift;
+
+static inline struct item *item_deref(uint32_t ref) {
+    return ref == 0 ? NULL : (struct item *)(heap_base + ((size_t)ref << item_ref_shift));
+}
+
+//no item sits at the heap base, which holds a slab header
+static inline uint32_t item_ref(struct item *it) {
+    return it == NULL ? 0 : (uint32_t)(((uint8_t *)it - heap_base) >> item_ref_shift);
+}
+
+#define ITEMQ_EMPTY(q) ((q)->first == 0)
+#define ITEMQ_FIRST(q) item_deref((q)->first)
+#define ITEMQ_NEXT(it, field) item_deref((it)->field.next)
+
+#define ITEMQ_INIT(q) do { \
+    (q)->first = 0; \
+    (q)->last = 0; \
+} while (0)
+
+#define ITEMQ_INSERT_TAIL(q, it, field) do { \
+    uint32_t ref_ = item_ref(it); \
+    (it)->field.next = 0; \
+    (it)->field.prev = (q)->last; \
+    if ((q)->last != 0) \
+        item_deref((q)->last)->field.next = ref_; \
+    else \
+        (q)->first = ref_; \
+    (q)->last = ref_; \
+} while (0)
+
+#define ITEMQ_INSERT_HEAD(q, it, field) do { \
+    uint32_t ref_ = item_ref(it); \
+    (it)->field.prev = 0; \
+    (it)->field.next = (q)->first; \
+    if ((q)->first != 0) \
+        item_deref((q)->first)->field.prev = ref_; \
+    else \
+        (q)->last = ref_; \
+    (q)->first = ref_; \
+} while (0)
+
+#define ITEMQ_INSERT_AFTER(q, listit, it, field) do { \
+    uint32_t ref_ = item_ref(it); \
+    (it)->field.prev = item_ref(listit); \
+    (it)->field.next = (listit)->field.next; \
+    if ((it)->field.next != 0) \
+        item_deref((it)->field.next)->field.prev = ref_; \
+    else \
+        (q)->last = ref_; \
+    (listit)->field.next = ref_; \
+} while (0)
+
+#define ITEMQ_REMOVE(q, it, field) do { \
+    if ((it)->field.next != 0) \
+        item_deref((it)->field.next)->field.prev = (it)->field.prev; \
+    else \
+        (q)->last = (it)->field.prev; \
+    if ((it)->field.prev != 0) \
+        item_deref((it)->field.prev)->field.next = (it)->field.next; \
+    else \
+        (q)->first = (it)->field.next; \
+} while (0)
 
 #define ITEM_HDR_SIZE offsetof(struct item, end)
 
+//latest exptime an item can hold, some 34 years
+#define ITEM_EXPTIME_MAX (((int64_t)1 << 40) - 1)
+
+//the second the item is expired by, rounded up so that the wheel and the crawler never free it early
+static inline int item_exptime_sec(struct item *it) {
+    return (int)((it->exptime + 999) / 1000);
+}
+
 static inline char *item_key(struct item *it) {
     char *key;
     assert(it->magic == ITEM_MAGIC);
@@ -46,6 +169,24 @@ static inline bool item_is_slabbed(struct item *it) {
     return (it->flags & ITEM_SLABBED);
 }
 
+static inline bool item_is_retired(struct item *it) {
+    return (it->flags & ITEM_RETIRED);
+}
+
+//value spread over chunk items, read it with item_iov
+static inline bool item_is_chained(struct item *it) {
+    return (it->flags & ITEM_CHAINED);
+}
+
+static inline bool item_is_chunk(struct item *it) {
+    return (it->flags & ITEM_CHUNK);
+}
+
+//on the protected queue of a segmented lru
+static inline bool item_is_protected(struct item *it) {
+    return (it->flags & ITEM_PROTECTED);
+}
+
 static inline bool item_is_raligned(struct item *it) {
     return (it->flags & ITEM_RALIGN);
 }
@@ -60,17 +201,49 @@ static inline size_t item_size(struct item *it) {
     return item_ntotal(it->nkey, it->nbyte);
 }
 
+struct shard;
+struct iovec;
+
 void item_init(void);
+rstatus_t item_crawler_init(void);
+uint64_t item_crawler_nbyte(uint64_t *last);
+uint64_t item_crawler_npass(void);
+void item_wheel_tick(int now);
+uint64_t item_wheel_nexpired(void);
+bool item_expired(struct item *it);
 char *item_data(struct item *it);
 struct slab *item_2_slab(struct item *it);
-void item_reuse(struct item *it);
-void item_hdr_init(struct item *it, uint32_t offset, uint8_t id);
+struct shard *item_2_shard(struct item *it);
+void item_reuse(struct shard *s, struct item *it);
+void item_move(struct shard *s, struct item *it, struct item *nit);
+void item_unretire(struct shard *s, struct item *it);
+void item_reclaim(struct shard *s);
+void item_pin(struct shard *s, struct item *it);
+void item_unpin(struct shard *s, struct item *it);
+void item_hdr_init(struct item *it, uint8_t id);
+bool item_recover(struct shard *s, struct item *it, uint8_t id, int delta);
+bool item_recover_chunk(struct item *it, uint8_t id);
+bool item_recover_chain(struct shard *s, struct item *it);
+bool item_recover_orphan(struct item *it);
+bool item_relink(struct shard *s, struct item *it);
 uint8_t item_slabid(uint16_t nkey, uint32_t nbyte);
-struct item *item_alloc(uint8_t id, char *key, uint16_t nkey, int exptime, char *value, uint32_t nbyte);
+uint8_t item_chain_slabid(uint16_t nkey, uint32_t nbyte);
+uint32_t item_max_nbyte(void);
+uint32_t item_iov(struct item *it, struct iovec *iov, uint32_t niov);
+void item_unchain(struct shard *s, struct item *it, bool retire);
+struct item *item_alloc(uint8_t id, char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, char *value, uint32_t nbyte);
+struct item *item_reserve(uint8_t id, char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, uint32_t nbyte);
+struct item *item_reserve_chain(uint8_t id, char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, uint32_t nbyte);
+struct item *item_alloc_chain(uint8_t id, char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, char *value, uint32_t nbyte);
+void item_commit(struct item *it);
+void item_abort(struct item *it);
 void item_delete(struct item *it);
 void item_remove(struct item *it);
 void item_touch(struct item *it);
-struct item *item_get(const char *key, uint16_t nkey);
+struct item *item_get(const char *key, uint16_t nkey, uint32_t hv);
+void item_mget(const char **keys, const uint16_t *nkeys, const uint32_t *hvs, uint32_t n, struct item **items);
+uint32_t item_mput(char **keys, const uint16_t *nkeys, const uint32_t *hvs, const uint8_t *ids, int64_t ttl_ms,
+                   char **values, const uint32_t *nbytes, uint32_t n);
 
 #endif
 
@@ -2,6 +2,12 @@
 #include "local.h"
 #include "assoc.h"
 #include "item.h"
+#include "shard.h"
+#include "epoch.h"
+#include "hash.h"
+#include "dump.h"
+#include "admit.h"
+#include "seg.h"
 
 struct settings settings;
 
@@ -9,31 +15,221 @@ struct settings *local_config(void) {
     return &settings;
 }
 
+//segments replace the items, slabs and lru queues, only shards and the clock are shared
+static bool local_start_seg(void) {
+    rstatus_t status = hash_init(settings.hash_opt);
+    if (status != MC_OK) return false;
+    status = shard_init();
+    if (status != MC_OK) return false;
+    time_on_tick(NULL);
+    status = time_init();
+    if (status != MC_OK) return false;
+    status = seg_init();
+    return status == MC_OK;
+}
+
 bool local_start(void) {
+    if (settings.engine == ENGINE_SEG) return local_start_seg();
+#ifndef ITEM_WHEEL
+    //items have no wheel links unless built with ITEM_WHEEL
+    if (settings.use_wheel) return false;
+#endif
+	rstatus_t status = hash_init(settings.hash_opt);
+    if (status != MC_OK) return false;
+	status = shard_init();
+    if (status != MC_OK) return false;
+    status = epoch_init();
+    if (status != MC_OK) return false;
 	item_init();
-	rstatus_t status = assoc_init();
+	status = assoc_init();
     if (status != MC_OK) return false;
+    time_on_tick(settings.use_wheel ? item_wheel_tick : NULL);
     status = time_init();
     if (status != MC_OK) return false;
     status = slab_init();
     if (status != MC_OK) return false;
+    status = item_crawler_init();
+    if (status != MC_OK) return false;
+    //sized to the most items the smallest class could hold
+    if (settings.use_admit) {
+        status = admit_init(settings.maxbytes / slab_item_size(SLABCLASS_MIN_ID));
+        if (status != MC_OK) return false;
+    }
     return true;
 }
 
 void local_back(struct item *value) {
     if (value == NULL) return;
+    if (settings.engine == ENGINE_SEG) {
+        seg_back((struct seg_item *)value);
+        return;
+    }
     item_remove(value);
 }
 
 struct item *local_get(const char *key, uint16_t nkey) {
 	if (key == NULL || nkey <= 0) return NULL;
-    return item_get(key, nkey);
+    if (settings.engine == ENGINE_SEG) return (struct item *)seg_get(key, nkey, hash(key, nkey, 0));
+    return item_get(key, nkey, hash(key, nkey, 0));
 }
 
 bool local_put(char *key, uint16_t nkey, int exptime, char *value, uint32_t nbyte) {
-    if (key == NULL || value == NULL || nkey <= 0 || nbyte <= 0 || exptime < 0) return false;
+    if (exptime < 0) return false;
+    return local_put_ms(key, nkey, (int64_t)exptime * 1000, value, nbyte);
+}
+
+bool local_put_ms(char *key, uint16_t nkey, int64_t ttl_ms, char *value, uint32_t nbyte) {
+    if (key == NULL || value == NULL || nkey <= 0 || nbyte <= 0 || ttl_ms < 0) return false;
+    if (settings.engine == ENGINE_SEG) return seg_put(key, nkey, hash(key, nkey, 0), ttl_ms, value, nbyte);
 	uint8_t id = item_slabid(nkey, nbyte);
-    if (id == SLABCLASS_INVALID_ID) return false;
-    struct item *store = item_alloc(id, key, nkey, exptime, value, nbyte);
+    struct item *store;
+    if (id == SLABCLASS_INVALID_ID) {
+        //too big for any class, spread it over chunks
+        id = item_chain_slabid(nkey, nbyte);
+        if (id == SLABCLASS_INVALID_ID) return false;
+        store = item_alloc_chain(id, key, nkey, hash(key, nkey, 0), ttl_ms, value, nbyte);
+        return store == NULL ? false : true;
+    }
+    store = item_alloc(id, key, nkey, hash(key, nkey, 0), ttl_ms, value, nbyte);
     return store == NULL ? false : true;
 }
+
+uint32_t local_iov(struct item *value, struct iovec *iov, uint32_t niov) {
+    if (value == NULL) return 0;
+    if (settings.engine == ENGINE_SEG) return seg_iov((struct seg_item *)value, iov, niov);
+    return item_iov(value, iov, niov);
+}
+
+struct item *local_reserve(char *key, uint16_t nkey, int exptime, uint32_t nbyte) {
+    if (key == NULL || nkey <= 0 || nbyte <= 0 || exptime < 0) return NULL;
+    if (settings.engine == ENGINE_SEG) return (struct item *)seg_reserve(key, nkey, hash(key, nkey, 0), (int64_t)exptime * 1000, nbyte);
+    uint8_t id = item_slabid(nkey, nbyte);
+    if (id == SLABCLASS_INVALID_ID) {
+        id = item_chain_slabid(nkey, nbyte);
+        if (id == SLABCLASS_INVALID_ID) return NULL;
+        return item_reserve_chain(id, key, nkey, hash(key, nkey, 0), (int64_t)exptime * 1000, nbyte);
+    }
+    return item_reserve(id, key, nkey, hash(key, nkey, 0), (int64_t)exptime * 1000, nbyte);
+}
+
+void local_commit(struct item *value) {
+    if (value == NULL) return;
+    if (settings.engine == ENGINE_SEG) {
+        seg_commit((struct seg_item *)value);
+        return;
+    }
+    item_commit(value);
+}
+
+void local_abort(struct item *value) {
+    if (value == NULL) return;
+    if (settings.engine == ENGINE_SEG) {
+        seg_abort((struct seg_item *)value);
+        return;
+    }
+    item_abort(value);
+}
+
+uint32_t local_mget(const char **keys, const uint16_t *nkeys, uint32_t n, struct item **items) {
+    const char *bkeys[ITEM_BATCH_MAX];
+    uint16_t bnkeys[ITEM_BATCH_MAX];
+    uint32_t hvs[ITEM_BATCH_MAX], idx[ITEM_BATCH_MAX];
+    struct item *bitems[ITEM_BATCH_MAX];
+    uint32_t i, j, m, nhit = 0;
+    if (settings.engine == ENGINE_SEG) {
+        for (i = 0; i < n; i++) {
+            items[i] = keys[i] == NULL ? NULL : local_get(keys[i], nkeys[i]);
+            if (items[i] != NULL) nhit++;
+        }
+        return nhit;
+    }
+    //hash a window of valid keys up front, then resolve it in one go
+    for (i = 0; i < n;) {
+        for (m = 0; i < n && m < ITEM_BATCH_MAX; i++) {
+            items[i] = NULL;
+            if (keys[i] == NULL || nkeys[i] == 0) continue;
+            bkeys[m] = keys[i];
+            bnkeys[m] = nkeys[i];
+            hvs[m] = hash(keys[i], nkeys[i], 0);
+            idx[m++] = i;
+        }
+        item_mget(bkeys, bnkeys, hvs, m, bitems);
+        for (j = 0; j < m; j++) {
+            items[idx[j]] = bitems[j];
+            if (bitems[j] != NULL) nhit++;
+        }
+    }
+    return nhit;
+}
+
+uint32_t local_mput(char **keys, const uint16_t *nkeys, char **values, const uint32_t *nbytes, int exptime, uint32_t n) {
+    char *bkeys[ITEM_BATCH_MAX], *bvalues[ITEM_BATCH_MAX];
+    uint16_t bnkeys[ITEM_BATCH_MAX];
+    uint32_t hvs[ITEM_BATCH_MAX], bnbytes[ITEM_BATCH_MAX];
+    uint8_t ids[ITEM_BATCH_MAX];
+    uint32_t i, m, nstored = 0;
+    if (exptime < 0) return 0;
+    if (settings.engine == ENGINE_SEG) {
+        for (i = 0; i < n; i++) {
+            if (local_put(keys[i], nkeys[i], exptime, values[i], nbytes[i])) nstored++;
+        }
+        return nstored;
+    }
+    for (i = 0; i < n;) {
+        for (m = 0; i < n && m < ITEM_BATCH_MAX; i++) {
+            if (keys[i] == NULL || values[i] == NULL || nkeys[i] == 0 || nbytes[i] == 0) continue;
+            ids[m] = item_slabid(nkeys[i], nbytes[i]);
+            //chained values go alone
+            if (ids[m] == SLABCLASS_INVALID_ID) {
+                if (local_put(keys[i], nkeys[i], exptime, values[i], nbytes[i])) nstored++;
+                continue;
+            }
+            bkeys[m] = keys[i];
+            bnkeys[m] = nkeys[i];
+            bvalues[m] = values[i];
+            bnbytes[m] = nbytes[i];
+            hvs[m++] = hash(keys[i], nkeys[i], 0);
+        }
+        nstored += item_mput(bkeys, bnkeys, hvs, ids, (int64_t)exptime * 1000, bvalues, bnbytes, m);
+    }
+    return nstored;
+}
+
+bool local_dump(const char *path) {
+    if (path == NULL || settings.engine == ENGINE_SEG) return false;
+    return dump_save(path) == MC_OK;
+}
+
+bool local_load(const char *path, uint32_t nthread) {
+    if (path == NULL || settings.engine == ENGINE_SEG) return false;
+    return dump_load(path, nthread) == MC_OK;
+}
+
+uint8_t local_profile(size_t *profile, uint8_t nclass) {
+    if (profile == NULL || settings.engine == ENGINE_SEG) return 0;
+    return slab_profile_propose(profile, nclass);
+}
+
+void local_stats(struct local_stats *stats) {
+    struct slab_magazine_stats mstats;
+    struct seg_stats sstats;
+    memset(stats, 0, sizeof(*stats));
+    if (settings.engine == ENGINE_SEG) {
+        seg_stats(&sstats);
+        stats->seg_expired = sstats.nexpired;
+        stats->seg_merged = sstats.nmerged;
+        stats->seg_evicted = sstats.nevicted;
+        return;
+    }
+    slab_magazine_stats(&mstats);
+    stats->magazine_alloc_hit = mstats.alloc_hit;
+    stats->magazine_alloc_miss = mstats.alloc_miss;
+    stats->magazine_free_hit = mstats.free_hit;
+    stats->magazine_free_miss = mstats.free_miss;
+    stats->slab_moved = slab_rebalance_nmoved();
+    stats->slab_compacted = slab_compact_nslab();
+    stats->admit_rejected = admit_nreject();
+    stats->crawl_reclaimed = item_crawler_nbyte(&stats->crawl_last_reclaimed);
+    stats->crawl_passes = item_crawler_npass();
+    stats->wheel_expired = item_wheel_nexpired();
+}
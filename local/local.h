@@ -2,16 +2,64 @@
 #define LOCAL_H_
 #include "cache.h"
 #include "item.h"
+#include <sys/uio.h>
+
+struct local_stats {
+    //items allocated or freed through a thread's magazine vs the shared lists
+    uint64_t magazine_alloc_hit;
+    uint64_t magazine_alloc_miss;
+    uint64_t magazine_free_hit;
+    uint64_t magazine_free_miss;
+    //slabs the rebalancer moved from one class to another
+    uint64_t slab_moved;
+    //sparse slabs emptied by moving their live items into free slots of the class
+    uint64_t slab_compacted;
+    //puts the admission filter refused because their victim was read more often
+    uint64_t admit_rejected;
+    //bytes of expired items the crawler unlinked in all and in its last pass, and the passes it made
+    uint64_t crawl_reclaimed;
+    uint64_t crawl_last_reclaimed;
+    uint64_t crawl_passes;
+    //expired items the timing wheel freed on its own
+    uint64_t wheel_expired;
+    //under ENGINE_SEG, segments freed whole because they expired, merged into one, or dropped
+    uint64_t seg_expired;
+    uint64_t seg_merged;
+    uint64_t seg_evicted;
+};
 
 //get local configs to set
 struct settings *local_config(void);
-//start cache model
+//start cache model, under ENGINE_SEG the items handed out are opaque, read them with local_iov
 bool local_start(void);
-//put cache item back
+//put cache item back, on the thread that got it when lockfree_read is set
 void local_back(struct item *value);
 //get cache item
 struct item *local_get(const char *key, uint16_t nkey);
-//set cache item
+//set cache item, values too big for any class are stored as a chain of chunks
 bool local_put(char *key, uint16_t nkey, int exptime, char *value, uint32_t nbyte);
+//set cache item with a ttl in ms, rounded up to whole seconds under ENGINE_SEG
+bool local_put_ms(char *key, uint16_t nkey, int64_t ttl_ms, char *value, uint32_t nbyte);
+//scatter list of an item's value, returns the entries it takes and fills at most niov
+uint32_t local_iov(struct item *value, struct iovec *iov, uint32_t niov);
+//reserve a cache item of nbyte for the caller to write through local_iov, unseen until committed
+struct item *local_reserve(char *key, uint16_t nkey, int exptime, uint32_t nbyte);
+//make a reserved item visible, replacing any item under its key
+void local_commit(struct item *value);
+//give a reserved item back without ever showing it
+void local_abort(struct item *value);
+//get n cache items at once, items[i] is NULL on a miss and every hit goes back with local_back
+uint32_t local_mget(const char **keys, const uint16_t *nkeys, uint32_t n, struct item **items);
+//set n cache items at once with one exptime, returns how many were stored
+uint32_t local_mput(char **keys, const uint16_t *nkeys, char **values, const uint32_t *nbytes, int exptime, uint32_t n);
+//write every live item to a checksummed file, locking a shard only briefly at a time, not under ENGINE_SEG
+bool local_dump(const char *path);
+//put the items of a dump back with nthread threads, one per cpu when 0, not under ENGINE_SEG
+bool local_load(const char *path, uint32_t nthread);
+//fit at most nclass classes to the sampled item sizes into profile[1] up to the returned id,
+//0 without samples, a profile takes effect through local_config on the next local_start
+uint8_t local_profile(size_t *profile, uint8_t nclass);
+//snapshot of the cache counters
+void local_stats(struct local_stats *stats);
 
 #endif
@@ -4,6 +4,36 @@
 #include "cache.h"
 #include <unistd.h>
 
+//replay a trace of one key per line, storing a value of nbyte on every miss
+static int replay(const char *path, uint32_t nbyte) {
+	FILE *f = fopen(path, "r");
+	char line[256], *value;
+	uint64_t nget = 0, nmiss = 0;
+	size_t nkey;
+	if (f == NULL) {
+		printf("cannot open %s\n", path);
+		return 1;
+	}
+	value = calloc(1, nbyte);
+	while (fgets(line, sizeof(line), f) != NULL) {
+		nkey = strcspn(line, " \r\n");
+		if (nkey == 0) continue;
+		nget++;
+		struct item *res = local_get(line, nkey);
+		if (res != NULL) {
+			local_back(res);
+			continue;
+		}
+		nmiss++;
+		local_put(line, nkey, 86400, value, nbyte);
+	}
+	fclose(f);
+	free(value);
+	printf("gets %llu misses %llu miss ratio %.4f\n", (unsigned long long)nget, (unsigned long long)nmiss,
+		nget == 0 ? 0.0 : (double)nmiss / nget);
+	return 0;
+}
+
 int main (int argc, const char * argv[]) {
 	struct settings *settings = local_config();
 	settings->hash_power = 0;
@@ -13,11 +43,25 @@ int main (int argc, const char * argv[]) {
 	settings->slab_size = 1024 * 1024;
 	settings->use_freeq = true;
 	settings->use_lruq = true;
-	settings->profile_last_id = 12;
-	int i = 0, j = 0, n = 0;
-	for (i = 1; i < 13; i++) {
-		settings->profile[i] = 100 * i;
+	settings->nshard = 4;
+	settings->profile_last_id = 0;
+	settings->profile_min = 96;
+	settings->profile_max = 1200;
+	settings->profile_factor = 1.25;
+	//main <trace> <evict_opt> <maxbytes in MB> [admit] [engine] compares policies on a recorded trace
+	if (argc > 3) {
+		settings->evict_opt = atoi(argv[2]);
+		settings->maxbytes = (size_t)atoi(argv[3]) * 1024 * 1024;
+		settings->use_admit = argc > 4 && atoi(argv[4]) != 0;
+		settings->engine = argc > 5 ? atoi(argv[5]) : ENGINE_SLAB;
+		settings->nshard = 1;
+		if (!local_start()) {
+			printf("cache started fail\n");
+			return 1;
+		}
+		return replay(argv[1], 100);
 	}
+	int i = 0, j = 0, n = 0;
 	bool result = local_start();
 	if (result) printf("cache started\n");
 	else {
@@ -43,17 +87,18 @@ int main (int argc, const char * argv[]) {
 				return 1;
 			}
 			struct item *res = local_get(key, 8);
-			if (res == NULL || res->nbyte != n) {
+			struct iovec iov;
+			if (res == NULL || local_iov(res, &iov, 1) != 1 || iov.iov_len != n) {
 				printf("cache get item fail\n");
 				printf("%d %d\n", i, j);
 				return 1;
 			}
-			char *data = item_data(res);
-			if (*((int*)data) != i) {
+			if (*((int*)iov.iov_base) != i) {
 				printf("cache get value fail\n");
 				printf("%d %d\n", i, j);
 				return 1;
 			}
+			local_back(res);
 		}
 	}
 	return 0;
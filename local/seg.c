@@ -0,0 +1,617 @@
+#include "seg.h"
+#include "shard.h"
+#include <sys/uio.h>
+
+extern struct settings settings;
+
+//an index entry is a tag, a read count, a segment id and an offset, 0 when empty
+#define SEG_FREQ_BITS 8
+#define SEG_TAG_BITS 12
+#define SEG_ID_SHIFT SEG_OFFSET_BITS
+#define SEG_FREQ_SHIFT (SEG_OFFSET_BITS + SEG_ID_BITS)
+#define SEG_TAG_SHIFT (SEG_FREQ_SHIFT + SEG_FREQ_BITS)
+#define SEG_OFFSET_MASK (((uint64_t)1 << SEG_OFFSET_BITS) - 1)
+#define SEG_ID_MASK (((uint64_t)1 << SEG_ID_BITS) - 1)
+#define SEG_FREQ_MAX (((uint64_t)1 << SEG_FREQ_BITS) - 1)
+#define SEG_FREQ_MASK (SEG_FREQ_MAX << SEG_FREQ_SHIFT)
+//a segment takes writes for this share of its bucket's ttl, so items expire at most that much early
+#define SEG_OPEN_SHARE 8
+//at most one in this many segments of a pool takes writes, past that items go to an open bucket below
+#define SEG_OPEN_CAP 2
+//average item the index is sized for
+#define SEG_ITEM_AVG 64
+
+static uint8_t *seg_base;
+static struct seg *segs;
+static struct seg_pool *pools;
+//pools of the last seg_init, nshard may change before the next
+static uint32_t npool;
+static size_t seg_size;
+//segments of each pool, pool i owns ids from i * nseg_pool
+static uint32_t nseg_pool;
+
+static uint32_t seg_item_size(uint16_t nkey, uint32_t nbyte) {
+    uint64_t n = SEG_ITEM_HDR_SIZE + (uint64_t)nkey + nbyte;
+    n = (n + SEG_ALIGN - 1) & ~(uint64_t)(SEG_ALIGN - 1);
+    return n > seg_size ? 0 : (uint32_t)n;
+}
+
+static struct seg_item *seg_item_at(uint32_t sid, uint32_t pos) {
+    return (struct seg_item *)(seg_base + (size_t)sid * seg_size + pos);
+}
+
+static uint32_t seg_of(struct seg_item *it) {
+    return (uint32_t)(((uint8_t *)it - seg_base) / seg_size);
+}
+
+static uint32_t seg_pos(struct seg_item *it) {
+    return (uint32_t)(((uint8_t *)it - seg_base) % seg_size);
+}
+
+static struct seg_pool *seg_pool_of(uint32_t sid) {
+    return &pools[sid / nseg_pool];
+}
+
+//a remix of hv, whose high bits picked the shard and low bits the bucket, never 0
+static uint64_t seg_tag(uint32_t hv) {
+    return (((hv * 0x9e3779b1U) >> (32 - SEG_TAG_BITS)) | 1);
+}
+
+static uint64_t seg_entry(uint64_t tag, uint32_t sid, uint32_t pos) {
+    return (tag << SEG_TAG_SHIFT) | ((uint64_t)sid << SEG_ID_SHIFT) | (pos / SEG_ALIGN);
+}
+
+static uint64_t seg_entry_tag(uint64_t e) {
+    return e >> SEG_TAG_SHIFT;
+}
+
+static uint32_t seg_entry_id(uint64_t e) {
+    return (uint32_t)((e >> SEG_ID_SHIFT) & SEG_ID_MASK);
+}
+
+static uint64_t seg_entry_freq(uint64_t e) {
+    return (e & SEG_FREQ_MASK) >> SEG_FREQ_SHIFT;
+}
+
+static struct seg_item *seg_entry_item(uint64_t e) {
+    return seg_item_at(seg_entry_id(e), (uint32_t)(e & SEG_OFFSET_MASK) * SEG_ALIGN);
+}
+
+//8 buckets per power of two ms past 8, the first 8 are one ms each
+static uint16_t seg_ttl_bucket(int64_t ttl_ms) {
+    uint32_t t = ttl_ms <= 0 ? 0 : ttl_ms > UINT32_MAX ? UINT32_MAX : (uint32_t)ttl_ms;
+    int msb;
+    if (t < 8) {
+        return (uint16_t)t;
+    }
+    msb = 31 - __builtin_clz(t);
+    return (uint16_t)((msb - 2) * 8 + ((t >> (msb - 3)) & 7));
+}
+
+//shortest ttl of a bucket in ms, what its segments live for
+static int64_t seg_ttl_floor(uint16_t b) {
+    if (b < 8) {
+        return b;
+    }
+    return (int64_t)(8U + b % 8) << (b / 8 - 1);
+}
+
+//how long a segment of bucket b takes writes, and how far merged segments may differ in expiry
+static int64_t seg_open_span(uint16_t b) {
+    int64_t span = seg_ttl_floor(b) / SEG_OPEN_SHARE;
+    return span > 1 ? span : 1;
+}
+
+static void seg_stat_incr(uint64_t *counter) {
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t *seg_index_find(struct seg_pool *p, const char *key, uint16_t nkey, uint32_t hv) {
+    struct seg_bucket *b;
+    struct seg_item *it;
+    uint64_t tag = seg_tag(hv);
+    uint32_t i;
+    for (b = &p->buckets[hv & p->mask]; b != NULL; b = b->next) {
+        for (i = 0; i < SEG_BUCKET_SLOTS; i++) {
+            if (b->slot[i] == 0 || seg_entry_tag(b->slot[i]) != tag) {
+                continue;
+            }
+            it = seg_entry_item(b->slot[i]);
+            if (it->nkey == nkey && memcmp(it->end, key, nkey) == 0) {
+                return &b->slot[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+//the entry naming the item at sid and pos, no key compare needed
+static uint64_t *seg_index_locate(struct seg_pool *p, uint32_t hv, uint32_t sid, uint32_t pos) {
+    struct seg_bucket *b;
+    uint64_t e = seg_entry(seg_tag(hv), sid, pos);
+    uint32_t i;
+    for (b = &p->buckets[hv & p->mask]; b != NULL; b = b->next) {
+        for (i = 0; i < SEG_BUCKET_SLOTS; i++) {
+            if ((b->slot[i] & ~SEG_FREQ_MASK) == e) {
+                return &b->slot[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool seg_index_insert(struct seg_pool *p, uint32_t hv, uint64_t e) {
+    struct seg_bucket *b, *last = NULL;
+    uint32_t i;
+    for (b = &p->buckets[hv & p->mask]; b != NULL; last = b, b = b->next) {
+        for (i = 0; i < SEG_BUCKET_SLOTS; i++) {
+            if (b->slot[i] == 0) {
+                b->slot[i] = e;
+                return true;
+            }
+        }
+    }
+    b = calloc(1, sizeof(*b));
+    if (b == NULL) {
+        return false;
+    }
+    b->slot[0] = e;
+    last->next = b;
+    return true;
+}
+
+static void seg_ttl_append(struct seg_pool *p, uint32_t sid) {
+    struct seg_ttl *t = &p->ttl[segs[sid].ttl_bucket];
+    segs[sid].prev = t->tail;
+    segs[sid].next = -1;
+    if (t->tail >= 0) {
+        segs[t->tail].next = (int32_t)sid;
+    } else {
+        t->head = (int32_t)sid;
+    }
+    t->tail = (int32_t)sid;
+}
+
+static void seg_ttl_remove(struct seg_pool *p, uint32_t sid) {
+    struct seg_ttl *t = &p->ttl[segs[sid].ttl_bucket];
+    if (segs[sid].prev >= 0) {
+        segs[segs[sid].prev].next = segs[sid].next;
+    } else {
+        t->head = segs[sid].next;
+    }
+    if (segs[sid].next >= 0) {
+        segs[segs[sid].next].prev = segs[sid].prev;
+    } else {
+        t->tail = segs[sid].prev;
+    }
+}
+
+//nsid takes the place of sid in its ttl bucket
+static void seg_ttl_replace(struct seg_pool *p, uint32_t sid, uint32_t nsid) {
+    struct seg_ttl *t = &p->ttl[segs[sid].ttl_bucket];
+    segs[nsid].prev = segs[sid].prev;
+    segs[nsid].next = segs[sid].next;
+    if (segs[sid].prev >= 0) {
+        segs[segs[sid].prev].next = (int32_t)nsid;
+    } else {
+        t->head = (int32_t)nsid;
+    }
+    if (segs[sid].next >= 0) {
+        segs[segs[sid].next].prev = (int32_t)nsid;
+    } else {
+        t->tail = (int32_t)nsid;
+    }
+}
+
+static void seg_free_push(struct seg_pool *p, uint32_t sid) {
+    segs[sid].next = p->free;
+    segs[sid].prev = -1;
+    segs[sid].wpos = 0;
+    segs[sid].exptime = 0;
+    p->free = (int32_t)sid;
+}
+
+static int32_t seg_free_pop(struct seg_pool *p) {
+    int32_t sid = p->free;
+    if (sid >= 0) {
+        p->free = segs[sid].next;
+    }
+    return sid;
+}
+
+static bool seg_pinned(uint32_t sid) {
+    return __atomic_load_n(&segs[sid].refcount, __ATOMIC_RELAXED) != 0;
+}
+
+//take every item of a segment out of the index
+static void seg_clear(struct seg_pool *p, uint32_t sid) {
+    struct seg_item *it;
+    uint64_t *slot;
+    uint32_t pos;
+    for (pos = 0; pos < segs[sid].wpos; pos += seg_item_size(it->nkey, it->nbyte)) {
+        it = seg_item_at(sid, pos);
+        if (it->flags & (SEG_ITEM_DELETED | SEG_ITEM_RESERVED)) {
+            continue;
+        }
+        slot = seg_index_locate(p, it->hv, sid, pos);
+        if (slot != NULL) {
+            *slot = 0;
+        }
+    }
+}
+
+static void seg_release(struct seg_pool *p, uint32_t sid) {
+    seg_ttl_remove(p, sid);
+    seg_clear(p, sid);
+    seg_free_push(p, sid);
+}
+
+//free the expired segments at the head of every ttl bucket, true if any
+static bool seg_expire(struct seg_pool *p) {
+    int32_t sid;
+    uint32_t b;
+    int64_t now = time_now_ms();
+    bool done = false;
+    for (b = 0; b < SEG_TTL_NBUCKET; b++) {
+        while ((sid = p->ttl[b].head) >= 0 && segs[sid].exptime <= now && !seg_pinned((uint32_t)sid)) {
+            seg_release(p, (uint32_t)sid);
+            seg_stat_incr(&p->nexpired);
+            done = true;
+        }
+    }
+    return done;
+}
+
+//copy the items of src read since they were written into dst while it has room, drop the rest
+static void seg_merge_one(struct seg_pool *p, uint32_t src, uint32_t dst) {
+    struct seg_item *it;
+    uint64_t *slot, freq;
+    uint32_t pos, size;
+    for (pos = 0; pos < segs[src].wpos; pos += size) {
+        it = seg_item_at(src, pos);
+        size = seg_item_size(it->nkey, it->nbyte);
+        if (it->flags & (SEG_ITEM_DELETED | SEG_ITEM_RESERVED)) {
+            continue;
+        }
+        slot = seg_index_locate(p, it->hv, src, pos);
+        if (slot == NULL) {
+            continue;
+        }
+        freq = seg_entry_freq(*slot);
+        if (freq == 0 || segs[dst].wpos + size > seg_size) {
+            *slot = 0;
+            continue;
+        }
+        memcpy(seg_item_at(dst, segs[dst].wpos), it, size);
+        //halved so that a kept item must be read again to survive the next merge
+        *slot = seg_entry(seg_entry_tag(*slot), dst, segs[dst].wpos) | ((freq >> 1) << SEG_FREQ_SHIFT);
+        segs[dst].wpos += size;
+    }
+}
+
+//merge the oldest closed segments of a ttl bucket into the spare, which takes their place
+//and lives as long as the last of them, at most one open span past the first
+static bool seg_merge(struct seg_pool *p) {
+    uint32_t src[SEG_MERGE_N];
+    uint32_t b, i, n, k;
+    uint32_t dst;
+    int32_t sid, head;
+    if (p->spare < 0) {
+        return false;
+    }
+    for (k = 0; k < SEG_TTL_NBUCKET; k++) {
+        b = (p->cursor + k) % SEG_TTL_NBUCKET;
+        head = p->ttl[b].head;
+        for (n = 0, sid = head; n < SEG_MERGE_N && sid >= 0 && sid != p->ttl[b].tail && !seg_pinned((uint32_t)sid) &&
+            segs[sid].exptime <= segs[head].exptime + seg_open_span((uint16_t)b); sid = segs[sid].next) {
+            src[n++] = (uint32_t)sid;
+        }
+        if (n >= 2) {
+            break;
+        }
+    }
+    if (k == SEG_TTL_NBUCKET) {
+        return false;
+    }
+    p->cursor = (uint16_t)((b + 1) % SEG_TTL_NBUCKET);
+    dst = (uint32_t)p->spare;
+    segs[dst].wpos = 0;
+    segs[dst].create_at = segs[src[0]].create_at;
+    segs[dst].exptime = 0;
+    segs[dst].ttl_bucket = (uint16_t)b;
+    for (i = 0; i < n; i++) {
+        if (segs[src[i]].exptime > segs[dst].exptime) {
+            segs[dst].exptime = segs[src[i]].exptime;
+        }
+        seg_merge_one(p, src[i], dst);
+    }
+    seg_ttl_replace(p, src[0], dst);
+    segs[src[0]].wpos = 0;
+    segs[src[0]].exptime = 0;
+    p->spare = (int32_t)src[0];
+    for (i = 1; i < n; i++) {
+        seg_ttl_remove(p, src[i]);
+        seg_free_push(p, src[i]);
+    }
+    seg_stat_incr(&p->nmerged);
+    return true;
+}
+
+//no bucket has two segments to merge, drop the oldest segment that no reader holds
+static bool seg_evict(struct seg_pool *p) {
+    int32_t sid, victim = -1;
+    uint32_t b;
+    for (b = 0; b < SEG_TTL_NBUCKET; b++) {
+        sid = p->ttl[b].head;
+        while (sid >= 0 && seg_pinned((uint32_t)sid)) {
+            sid = segs[sid].next;
+        }
+        if (sid >= 0 && (victim < 0 || segs[sid].create_at < segs[victim].create_at)) {
+            victim = sid;
+        }
+    }
+    if (victim < 0) {
+        return false;
+    }
+    seg_release(p, (uint32_t)victim);
+    seg_stat_incr(&p->nevicted);
+    return true;
+}
+
+static int32_t seg_open(struct seg_pool *p, uint16_t b) {
+    int32_t sid = seg_free_pop(p);
+    int64_t now = time_now_ms();
+    if (sid < 0 && (seg_expire(p) || seg_merge(p) || seg_evict(p))) {
+        sid = seg_free_pop(p);
+    }
+    if (sid < 0) {
+        return -1;
+    }
+    segs[sid].wpos = 0;
+    segs[sid].create_at = now;
+    segs[sid].exptime = now + seg_ttl_floor(b);
+    segs[sid].ttl_bucket = b;
+    seg_ttl_append(p, (uint32_t)sid);
+    return sid;
+}
+
+//a bucket's tail still taking writes of size bytes
+static bool seg_takes(int32_t sid, uint32_t size, int64_t now) {
+    return sid >= 0 && segs[sid].wpos + size <= seg_size && now - segs[sid].create_at <= seg_open_span(segs[sid].ttl_bucket);
+}
+
+static uint32_t seg_nopen(struct seg_pool *p, int64_t now) {
+    uint32_t b, n = 0;
+    for (b = 0; b < SEG_TTL_NBUCKET; b++) {
+        n += seg_takes(p->ttl[b].tail, SEG_ALIGN, now);
+    }
+    return n;
+}
+
+//the segment taking writes for ttl bucket b with size bytes left, opening one if need be
+static int32_t seg_writable(struct seg_pool *p, uint16_t b, uint32_t size) {
+    int32_t sid = p->ttl[b].tail;
+    int64_t now = time_now_ms();
+    uint32_t cap = nseg_pool / SEG_OPEN_CAP;
+    uint16_t lb;
+    if (seg_takes(sid, size, now)) {
+        return sid;
+    }
+    //every open bucket holds a segment mostly empty, so a small pool shares them, items expiring early
+    if (seg_nopen(p, now) >= (cap > 1 ? cap : 1)) {
+        for (lb = b; lb-- > 0;) {
+            if (seg_takes(p->ttl[lb].tail, size, now)) {
+                return p->ttl[lb].tail;
+            }
+        }
+    }
+    return seg_open(p, b);
+}
+
+static struct seg_item *seg_append(struct seg_pool *p, char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms,
+                                   uint32_t nbyte) {
+    struct seg_item *it;
+    uint32_t size = seg_item_size(nkey, nbyte);
+    int32_t sid;
+    if (size == 0) {
+        return NULL;
+    }
+    sid = seg_writable(p, seg_ttl_bucket(ttl_ms), size);
+    if (sid < 0) {
+        return NULL;
+    }
+    it = seg_item_at((uint32_t)sid, segs[sid].wpos);
+    it->hv = hv;
+    it->nbyte = nbyte;
+    it->nkey = nkey;
+    it->flags = 0;
+    it->unused = 0;
+    memcpy(it->end, key, nkey);
+    segs[sid].wpos += size;
+    return it;
+}
+
+//index it in place of any older item under its key
+static bool seg_link(struct seg_pool *p, struct seg_item *it, uint32_t hv) {
+    uint64_t *slot = seg_index_find(p, it->end, it->nkey, hv);
+    uint64_t e = seg_entry(seg_tag(hv), seg_of(it), seg_pos(it));
+    if (slot != NULL) {
+        seg_entry_item(*slot)->flags |= SEG_ITEM_DELETED;
+        *slot = e;
+        return true;
+    }
+    if (seg_index_insert(p, hv, e)) {
+        return true;
+    }
+    it->flags |= SEG_ITEM_DELETED;
+    return false;
+}
+
+struct seg_item *seg_get(const char *key, uint16_t nkey, uint32_t hv) {
+    struct shard *s = shard_get(hv);
+    struct seg_pool *p = &pools[s->id];
+    struct seg_item *it = NULL;
+    uint64_t *slot;
+    uint32_t sid;
+    pthread_mutex_lock(&s->lock);
+    slot = seg_index_find(p, key, nkey, hv);
+    if (slot != NULL && segs[seg_entry_id(*slot)].exptime > time_now_ms()) {
+        if (seg_entry_freq(*slot) < SEG_FREQ_MAX) {
+            *slot += (uint64_t)1 << SEG_FREQ_SHIFT;
+        }
+        it = seg_entry_item(*slot);
+        sid = seg_entry_id(*slot);
+        __atomic_add_fetch(&segs[sid].refcount, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return it;
+}
+
+//a segment is only expired, merged or evicted once no reader holds an item of it
+void seg_back(struct seg_item *it) {
+    __atomic_sub_fetch(&segs[seg_of(it)].refcount, 1, __ATOMIC_RELEASE);
+}
+
+//a ttl of 0 stores an item already expired, which still hides the older one
+bool seg_put(char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, char *value, uint32_t nbyte) {
+    struct shard *s = shard_get(hv);
+    struct seg_pool *p = &pools[s->id];
+    struct seg_item *it;
+    bool stored = false;
+    pthread_mutex_lock(&s->lock);
+    it = seg_append(p, key, nkey, hv, ttl_ms, nbyte);
+    if (it != NULL) {
+        memcpy(it->end + nkey, value, nbyte);
+        stored = seg_link(p, it, hv);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return stored;
+}
+
+//appended but unindexed, its segment held until seg_commit or seg_abort
+struct seg_item *seg_reserve(char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, uint32_t nbyte) {
+    struct shard *s = shard_get(hv);
+    struct seg_pool *p = &pools[s->id];
+    struct seg_item *it;
+    pthread_mutex_lock(&s->lock);
+    it = seg_append(p, key, nkey, hv, ttl_ms, nbyte);
+    if (it != NULL) {
+        it->flags |= SEG_ITEM_RESERVED;
+        __atomic_add_fetch(&segs[seg_of(it)].refcount, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return it;
+}
+
+void seg_commit(struct seg_item *it) {
+    struct shard *s = shard_get(it->hv);
+    pthread_mutex_lock(&s->lock);
+    it->flags &= ~SEG_ITEM_RESERVED;
+    seg_link(seg_pool_of(seg_of(it)), it, it->hv);
+    seg_back(it);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void seg_abort(struct seg_item *it) {
+    struct shard *s = &shards[seg_of(it) / nseg_pool];
+    pthread_mutex_lock(&s->lock);
+    it->flags = SEG_ITEM_DELETED;
+    seg_back(it);
+    pthread_mutex_unlock(&s->lock);
+}
+
+uint32_t seg_iov(struct seg_item *it, struct iovec *iov, uint32_t niov) {
+    if (niov > 0) {
+        iov[0].iov_base = it->end + it->nkey;
+        iov[0].iov_len = it->nbyte;
+    }
+    return 1;
+}
+
+static rstatus_t seg_pool_init(struct seg_pool *p, uint32_t first) {
+    uint32_t i, nbucket = 1;
+    size_t want = (size_t)nseg_pool * seg_size / SEG_ITEM_AVG / SEG_BUCKET_SLOTS;
+    if (settings.hash_power > 0) {
+        nbucket = 1U << settings.hash_power;
+    } else {
+        while (nbucket < want && nbucket < (1U << 30)) {
+            nbucket <<= 1;
+        }
+    }
+    p->buckets = calloc(nbucket, sizeof(*p->buckets));
+    if (p->buckets == NULL) {
+        return MC_ENOMEM;
+    }
+    p->mask = nbucket - 1;
+    p->free = -1;
+    for (i = 0; i < SEG_TTL_NBUCKET; i++) {
+        p->ttl[i].head = -1;
+        p->ttl[i].tail = -1;
+    }
+    for (i = nseg_pool; i > 0; i--) {
+        seg_free_push(p, first + i - 1);
+    }
+    //merges need one segment to write into
+    p->spare = nseg_pool > 1 ? seg_free_pop(p) : -1;
+    return MC_OK;
+}
+
+//the index of a pool, overflow buckets included
+static void seg_pool_deinit(struct seg_pool *p) {
+    struct seg_bucket *b, *next;
+    uint32_t i;
+    for (i = 0; p->buckets != NULL && i <= p->mask; i++) {
+        for (b = p->buckets[i].next; b != NULL; b = next) {
+            next = b->next;
+            free(b);
+        }
+    }
+    free(p->buckets);
+    p->buckets = NULL;
+}
+
+//segments are slab_size bytes, split evenly between the shards
+rstatus_t seg_init(void) {
+    uint32_t i;
+    uint64_t n;
+    rstatus_t status;
+    seg_size = settings.slab_size;
+    if (seg_size < SEG_ALIGN * 2 || seg_size > SEG_MAX_SIZE || seg_size % SEG_ALIGN != 0) {
+        return MC_ERROR;
+    }
+    n = settings.maxbytes / seg_size / nshard;
+    if (n == 0 || n * nshard > SEG_MAX_NSEG) {
+        return MC_ERROR;
+    }
+    nseg_pool = (uint32_t)n;
+    for (i = 0; pools != NULL && i < npool; i++) {
+        seg_pool_deinit(&pools[i]);
+    }
+    free(seg_base);
+    free(segs);
+    free(pools);
+    seg_base = malloc((size_t)nseg_pool * nshard * seg_size);
+    segs = calloc((size_t)nseg_pool * nshard, sizeof(*segs));
+    pools = calloc(nshard, sizeof(*pools));
+    npool = pools == NULL ? 0 : nshard;
+    if (seg_base == NULL || segs == NULL || pools == NULL) {
+        return MC_ENOMEM;
+    }
+    for (i = 0; i < nshard; i++) {
+        status = seg_pool_init(&pools[i], i * nseg_pool);
+        if (status != MC_OK) {
+            return status;
+        }
+    }
+    return MC_OK;
+}
+
+void seg_stats(struct seg_stats *stats) {
+    uint32_t i;
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; pools != NULL && i < nshard; i++) {
+        stats->nexpired += __atomic_load_n(&pools[i].nexpired, __ATOMIC_RELAXED);
+        stats->nmerged += __atomic_load_n(&pools[i].nmerged, __ATOMIC_RELAXED);
+        stats->nevicted += __atomic_load_n(&pools[i].nevicted, __ATOMIC_RELAXED);
+    }
+}
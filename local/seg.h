@@ -0,0 +1,89 @@
+#ifndef LOCAL_SEG_H_
+#define LOCAL_SEG_H_
+#include "cache.h"
+
+//index entries per bucket, the bucket then links its overflow bucket
+#define SEG_BUCKET_SLOTS 7
+//ttl buckets, eight per power of two milliseconds
+#define SEG_TTL_NBUCKET 256
+//most segments one eviction merges into one
+#define SEG_MERGE_N 4
+//items start on this boundary, offsets in the index are counted in it
+#define SEG_ALIGN 8
+#define SEG_OFFSET_BITS 22
+#define SEG_ID_BITS 22
+#define SEG_MAX_SIZE ((size_t)SEG_ALIGN << SEG_OFFSET_BITS)
+#define SEG_MAX_NSEG ((uint32_t)1 << SEG_ID_BITS)
+
+typedef enum seg_item_flags {
+    SEG_ITEM_DELETED  = 1,
+    SEG_ITEM_RESERVED = 2,
+} seg_item_flags_t;
+
+//an item appended to a segment, no links, its ttl is the segment's
+struct seg_item {
+    uint32_t hv;    //finds its index entry when the segment is cleared or merged
+    uint32_t nbyte;
+    uint16_t nkey;
+    uint8_t  flags;
+    uint8_t  unused;
+    char     end[1];
+};
+
+#define SEG_ITEM_HDR_SIZE offsetof(struct seg_item, end)
+
+//one cache line of index entries, each a tag, a read count and where the item sits
+struct seg_bucket {
+    uint64_t          slot[SEG_BUCKET_SLOTS];
+    struct seg_bucket *next;
+};
+
+//a slab_size run of the heap written front to back, items of a ttl bucket only
+struct seg {
+    int32_t  prev;
+    int32_t  next;
+    uint32_t wpos;
+    uint32_t refcount;
+    int64_t  create_at;  //ms
+    int64_t  exptime;    //ms, its items are expired from then on
+    uint16_t ttl_bucket;
+};
+
+//segments of a ttl bucket oldest first, the tail takes the writes
+struct seg_ttl {
+    int32_t head;
+    int32_t tail;
+};
+
+//the segments and the index of one shard, under the shard lock
+struct seg_pool {
+    int32_t           free;
+    int32_t           spare;
+    struct seg_ttl    ttl[SEG_TTL_NBUCKET];
+    struct seg_bucket *buckets;
+    uint32_t          mask;
+    uint16_t          cursor;
+    uint64_t          nexpired;
+    uint64_t          nmerged;
+    uint64_t          nevicted;
+};
+
+struct seg_stats {
+    uint64_t nexpired;
+    uint64_t nmerged;
+    uint64_t nevicted;
+};
+
+struct iovec;
+
+rstatus_t seg_init(void);
+struct seg_item *seg_get(const char *key, uint16_t nkey, uint32_t hv);
+void seg_back(struct seg_item *it);
+bool seg_put(char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, char *value, uint32_t nbyte);
+struct seg_item *seg_reserve(char *key, uint16_t nkey, uint32_t hv, int64_t ttl_ms, uint32_t nbyte);
+void seg_commit(struct seg_item *it);
+void seg_abort(struct seg_item *it);
+uint32_t seg_iov(struct seg_item *it, struct iovec *iov, uint32_t niov);
+void seg_stats(struct seg_stats *stats);
+
+#endif
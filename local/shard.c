@@ -0,0 +1,33 @@
+#include "shard.h"
+
+extern struct settings settings;
+
+struct shard *shards;
+uint32_t nshard;
+
+rstatus_t shard_init(void) {
+    uint32_t i;
+    nshard = settings.nshard > 0 ? settings.nshard : SHARD_DEFAULT_NUM;
+    if (nshard > SHARD_MAX_NUM) {
+        return MC_ERROR;
+    }
+    shards = calloc(nshard, sizeof(*shards));
+    if (shards == NULL) {
+        return MC_ENOMEM;
+    }
+    for (i = 0; i < nshard; i++) {
+        shards[i].id = (uint8_t)i;
+        pthread_mutex_init(&shards[i].lock, NULL);
+    }
+    return MC_OK;
+}
+
+void shard_deinit(void) {
+    uint32_t i;
+    for (i = 0; i < nshard; i++) {
+        pthread_mutex_destroy(&shards[i].lock);
+    }
+    free(shards);
+    shards = NULL;
+    nshard = 0;
+}
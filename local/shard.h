@@ -0,0 +1,50 @@
+#ifndef LOCAL_SHARD_H_
+#define LOCAL_SHARD_H_
+#include "cache.h"
+#include "item.h"
+#include "slabs.h"
+#include "assoc.h"
+
+#define SHARD_DEFAULT_NUM 1
+#define SHARD_MAX_NUM (UCHAR_MAX + 1)
+
+//one independent partition of the cache, picked by key hash
+struct shard {
+    pthread_mutex_t      lock;
+    uint8_t              id;
+    struct item_tqh      item_lruq[SLABCLASS_MAX_IDS];
+    struct item_tqh      item_protq[SLABCLASS_MAX_IDS];
+    uint32_t             item_nlruq[SLABCLASS_MAX_IDS];
+    uint32_t             item_nprotq[SLABCLASS_MAX_IDS];
+    struct item_tqh      item_limboq;
+    uint32_t             nlimbo;
+    struct item_wheel    wheel;
+    struct assoc         assoc;
+    struct slabfree      slabfree[SLABCLASS_MAX_IDS];
+    struct slabpressure  pressure[SLABCLASS_MAX_IDS];
+    struct slab_heapinfo heapinfo;
+    //bumped to have every thread drain its magazines of this shard
+    uint32_t             magazine_gen;
+};
+
+extern struct shard *shards;
+extern uint32_t nshard;
+
+rstatus_t shard_init(void);
+void shard_deinit(void);
+
+static inline struct shard *shard_by_id(uint8_t sid) {
+    assert(sid < nshard);
+    return &shards[sid];
+}
+
+//use the high bits of the hash so that shards do not correlate with buckets
+static inline struct shard *shard_get(uint32_t hv) {
+    return &shards[(uint32_t)(((uint64_t)hv * nshard) >> 32)];
+}
+
+static inline bool shard_locked(struct shard *s) {
+    return pthread_mutex_trylock(&s->lock) != 0;
+}
+
+#endif
@@ -1,35 +1,84 @@
 #include "item.h"
 #include "slabs.h"
+#include "shard.h"
+#include "epoch.h"
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 extern struct settings settings;
-extern pthread_mutex_t cache_lock;
-
-struct slab_heapinfo {
-    uint8_t         *base;
-    uint8_t         *curr;
-    uint32_t        nslab;
-    uint32_t        max_nslab;
-    struct slab     **slab_table;
-    struct slab_tqh slab_lruq;
+
+struct slab_magazine_set {
+    struct slab_magazine_set   *next;
+    struct slab_magazine_stats stats;
+    struct slab_magazine       mags[1];
 };
 
 struct slabclass slabclass[SLABCLASS_MAX_IDS];
 uint8_t slabclass_max_id;
-static struct slab_heapinfo heapinfo;
+
+//smallest class id for each granule of item sizes up to the largest class
+static uint8_t *slab_lookup;
+static size_t slab_nlookup;
+//sampled item sizes by granule, the last bucket counts sizes past the largest class
+static uint64_t *profile_hist;
+#define HEAP_HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+#define HEAP_PAGE_SIZE 4096UL
+#define HEAP_MAGIC 0x3270616568636f6cULL
+#define HEAP_HDR_SIZE HEAP_PAGE_SIZE
+
+//leading page of a file backed heap, everything before started must match to reattach
+struct slab_heap_hdr {
+    uint64_t magic;
+    uint64_t slab_size;
+    uint32_t max_nslab;
+    uint32_t nshard;
+    uint32_t item_hdr_size;
+    int32_t  hash_opt;
+    uint32_t profile_last_id;
+    uint64_t profile[SLABCLASS_MAX_IDS];
+    int64_t  started;
+};
+
+//a job the slab thread runs on every shard in turn, returns true if it did anything
+struct slab_task {
+    uint32_t  ms;
+    bool      (*run)(struct shard *s);
+    uint64_t  ndone;
+    pthread_t tid;
+};
+
+static struct slab_task rebalance_task;
+static struct slab_task compact_task;
+//whole heap in one range, sliced between shards
+uint8_t *heap_base;
+uint8_t item_ref_shift = ITEM_REF_MIN_SHIFT;
+//file backed heap that still holds the items of an earlier run
+static bool heap_warm;
+//start time of that run, item times are relative to it
+static time_t heap_started;
+//magazines of every live thread, and counters of exited ones
+static pthread_key_t magazine_key;
+static pthread_mutex_t magazine_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct slab_magazine_set *magazine_sets;
+static struct slab_magazine_stats magazine_retired;
+static __thread struct slab_magazine_set *magazine_self;
 
 size_t slab_size(void) {
     return settings.slab_size - SLAB_HDR_SIZE;
 }
 
 void slab_acquire_refcount(struct slab *slab) {
-    assert(pthread_mutex_trylock(&cache_lock) != 0);
+    assert(shard_locked(shard_by_id(slab->sid)));
     assert(slab->magic == SLAB_MAGIC);
     slab->refcount++;
 }
 
 void slab_release_refcount(struct slab *slab) {
-    assert(pthread_mutex_trylock(&cache_lock) != 0);
+    assert(shard_locked(shard_by_id(slab->sid)));
     assert(slab->magic == SLAB_MAGIC);
     assert(slab->refcount > 0);
     slab->refcount--;
@@ -49,30 +98,84 @@ size_t slab_item_size(uint8_t id) {
     return slabclass[id].size;
 }
 
+static size_t slab_granule(size_t size) {
+    return (size - 1) >> SLAB_GRANULE_SHIFT;
+}
+
+//one table load, then at most a step per class boundary inside the granule
 uint8_t slab_id(size_t size) {
-    uint8_t id, imin, imax;
+    uint8_t id;
     assert(size != 0);
-    imin = SLABCLASS_MIN_ID;
-    imax = slabclass_max_id;
-    while (imax >= imin) {
-        id = (imin + imax) / 2;
-        if (size > slabclass[id].size) {
-            imin = id + 1;
-        } else if (id > SLABCLASS_MIN_ID && size <= slabclass[id - 1].size) {
-            imax = id - 1;
-        } else {
-            break;
-        }
-    }
-    if (imin > imax) {
+    if (size > slabclass[slabclass_max_id].size) {
         return SLABCLASS_INVALID_ID;
     }
+    id = slab_lookup[slab_granule(size)];
+    while (size > slabclass[id].size) {
+        id++;
+    }
     return id;
 }
 
-static void slab_slabclass_init(void) {
+//class sizes are whole ref units, so every item of a slab can be linked
+static size_t slab_profile_align(size_t size) {
+    size_t unit = (size_t)1 << item_ref_shift;
+    return (size + unit - 1) & ~(unit - 1);
+}
+
+//classes from profile_min growing by profile_factor up to profile_max
+static rstatus_t slab_profile_generate(void) {
+    size_t size, next, max;
+    double factor;
     uint8_t id;
+    factor = settings.profile_factor > 1.0 ? settings.profile_factor : SLAB_PROFILE_FACTOR;
+    max = settings.profile_max != 0 && settings.profile_max < slab_size() ? settings.profile_max : slab_size();
+    size = slab_profile_align(settings.profile_min > SLAB_PROFILE_MIN_SIZE ? settings.profile_min : SLAB_PROFILE_MIN_SIZE);
+    if (size > max) {
+        return MC_ERROR;
+    }
+    for (id = SLABCLASS_MIN_ID; id < SLABCLASS_MAX_ID && size < max; id++) {
+        settings.profile[id] = size;
+        next = slab_profile_align((size_t)((double)size * factor));
+        size = next > size ? next : size + ((size_t)1 << item_ref_shift);
+    }
+    settings.profile[id] = max;
+    settings.profile_last_id = id;
+    return MC_OK;
+}
+
+static rstatus_t slab_lookup_init(void) {
+    size_t g;
+    uint8_t id = SLABCLASS_MIN_ID;
+    slab_nlookup = slab_granule(slabclass[slabclass_max_id].size) + 1;
+    free(slab_lookup);
+    free(profile_hist);
+    profile_hist = NULL;
+    slab_lookup = malloc(slab_nlookup);
+    if (slab_lookup == NULL) {
+        return MC_ENOMEM;
+    }
+    for (g = 0; g < slab_nlookup; g++) {
+        while (slabclass[id].size < (g << SLAB_GRANULE_SHIFT) + 1) {
+            id++;
+        }
+        slab_lookup[g] = id;
+    }
+    if (settings.profile_sample != 0) {
+        profile_hist = calloc(slab_nlookup + 1, sizeof(*profile_hist));
+        if (profile_hist == NULL) {
+            return MC_ENOMEM;
+        }
+    }
+    return MC_OK;
+}
+
+static rstatus_t slab_slabclass_init(void) {
+    uint8_t id;
+    uint32_t i;
     size_t *profile;
+    if (settings.profile_last_id == 0 && slab_profile_generate() != MC_OK) {
+        return MC_ERROR;
+    }
     profile = settings.profile;
     slabclass_max_id = settings.profile_last_id;
     assert(slabclass_max_id <= SLABCLASS_MAX_ID);
@@ -80,160 +183,432 @@ static void slab_slabclass_init(void) {
         struct slabclass *p;
         uint32_t nitem;
         size_t item_sz;
-        nitem = slab_size() / profile[id];
-        item_sz = profile[id];
+        item_sz = slab_profile_align(profile[id]);
+        nitem = slab_size() / item_sz;
         p = &slabclass[id];
         p->nitem = nitem;
         p->size = item_sz;
-        p->nfree_itemq = 0;
-        TAILQ_INIT(&p->free_itemq);
-        p->nfree_item = 0;
-        p->free_item = NULL;
+        for (i = 0; i < nshard; i++) {
+            struct slabfree *f = &shards[i].slabfree[id];
+            f->nfree_itemq = 0;
+            ITEMQ_INIT(&f->free_itemq);
+            f->nfree_item = 0;
+            f->free_item = NULL;
+        }
     }
+    return slab_lookup_init();
+}
+
+//anonymous mapping aligned to the huge page size, so that khugepaged can back all of it
+static uint8_t *slab_heap_map_transparent(size_t size) {
+    uint8_t *p, *aligned;
+    size_t head, tail;
+    p = mmap(NULL, size + HEAP_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    aligned = (uint8_t *)(((uintptr_t)p + HEAP_HUGE_PAGE_SIZE - 1) & ~(HEAP_HUGE_PAGE_SIZE - 1));
+    head = aligned - p;
+    tail = HEAP_HUGE_PAGE_SIZE - head;
+    if (head > 0) {
+        munmap(p, head);
+    }
+    if (tail > 0) {
+        munmap(aligned + size, tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+static uint8_t *slab_heap_map(size_t size) {
+    uint8_t *p;
+    switch (settings.huge_page) {
+    case HUGEPAGE_EXPLICIT:
+#ifdef MAP_HUGETLB
+        size = (size + HEAP_HUGE_PAGE_SIZE - 1) & ~(HEAP_HUGE_PAGE_SIZE - 1);
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            return p;
+        }
+#endif
+        //pool too small, fall back to transparent huge pages
+        return slab_heap_map_transparent(size);
+    case HUGEPAGE_TRANSPARENT:
+        return slab_heap_map_transparent(size);
+    default:
+        return malloc(size);
+    }
+}
+
+//address space for slabs taken as they are needed, committed only once touched
+static uint8_t *slab_heap_reserve(size_t size) {
+    uint8_t *p;
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static void slab_heap_hdr_fill(struct slab_heap_hdr *hdr, uint32_t max_nslab) {
+    uint32_t id;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = HEAP_MAGIC;
+    hdr->slab_size = settings.slab_size;
+    hdr->max_nslab = max_nslab;
+    hdr->nshard = nshard;
+    hdr->item_hdr_size = ITEM_HDR_SIZE;
+    hdr->hash_opt = settings.hash_opt;
+    hdr->profile_last_id = settings.profile_last_id;
+    for (id = SLABCLASS_MIN_ID; id <= settings.profile_last_id; id++) {
+        hdr->profile[id] = settings.profile[id];
+    }
+}
+
+//shared mapping of heap_path, reattached when the layout matches and zeroed otherwise
+static uint8_t *slab_heap_map_file(size_t heap_size, uint32_t max_nslab) {
+    struct slab_heap_hdr expect, found, *hdr;
+    struct stat st;
+    size_t size = HEAP_HDR_SIZE + heap_size;
+    uint8_t *p;
+    int fd;
+    assert(sizeof(*hdr) <= HEAP_HDR_SIZE);
+    fd = open(settings.heap_path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    slab_heap_hdr_fill(&expect, max_nslab);
+    heap_warm = fstat(fd, &st) == 0 && (size_t)st.st_size == size &&
+                pread(fd, &found, sizeof(found), 0) == (ssize_t)sizeof(found) &&
+                memcmp(&found, &expect, offsetof(struct slab_heap_hdr, started)) == 0;
+    //stale slabs past the ones we allocate must never look live on a later restart
+    if (!heap_warm && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)) {
+        close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    hdr = (struct slab_heap_hdr *)p;
+    if (!heap_warm) {
+        *hdr = expect;
+    }
+    heap_started = (time_t)hdr->started;
+    hdr->started = (int64_t)time_started();
+    return p + HEAP_HDR_SIZE;
+}
+
+struct slab_prefault_arg {
+    uint8_t *start;
+    size_t  size;
+};
+
+static void *slab_prefault_thread(void *arg) {
+    struct slab_prefault_arg *pa = arg;
+    volatile uint8_t *p = pa->start;
+    size_t off;
+    //write back what is there, a reattached heap keeps its contents
+    for (off = 0; off < pa->size; off += HEAP_PAGE_SIZE) {
+        p[off] = p[off];
+    }
+    return NULL;
+}
+
+//fault the heap in up front instead of under the shard lock on first use
+static void slab_heap_prefault(uint8_t *base, size_t size) {
+    struct slab_prefault_arg *args, rest;
+    pthread_t *tids;
+    uint32_t i, nthread = settings.prefault_threads;
+    size_t chunk, off;
+    //whole huge pages per thread so two threads never fault the same one
+    chunk = (size / nthread + HEAP_HUGE_PAGE_SIZE - 1) & ~(HEAP_HUGE_PAGE_SIZE - 1);
+    args = malloc(sizeof(*args) * nthread);
+    tids = malloc(sizeof(*tids) * nthread);
+    if (args == NULL || tids == NULL) {
+        nthread = 0;
+    }
+    for (i = 0, off = 0; i < nthread && off < size; i++, off += chunk) {
+        args[i].start = base + off;
+        args[i].size = size - off < chunk ? size - off : chunk;
+        if (pthread_create(&tids[i], NULL, slab_prefault_thread, &args[i]) != 0) {
+            break;
+        }
+    }
+    //whatever no thread took is touched from here
+    if (off < size) {
+        rest.start = base + off;
+        rest.size = size - off;
+        slab_prefault_thread(&rest);
+    }
+    while (i > 0) {
+        pthread_join(tids[--i], NULL);
+    }
+    free(args);
+    free(tids);
+}
+
+//items are linked by ref from heap_base, so every slab sits in one range
+static size_t slab_heap_size(void) {
+    return (size_t)(settings.maxbytes / settings.slab_size / nshard) * nshard * settings.slab_size;
+}
+
+//the smallest ref unit that reaches the end of the heap, the first item of a slab sits on any of them
+static rstatus_t slab_ref_init(void) {
+    size_t heap_size = slab_heap_size();
+    assert(SLAB_HDR_SIZE % ((size_t)1 << ITEM_REF_MAX_SHIFT) == 0);
+    for (item_ref_shift = ITEM_REF_MIN_SHIFT; heap_size > ((size_t)UINT32_MAX << item_ref_shift); item_ref_shift++) {
+        if (item_ref_shift == ITEM_REF_MAX_SHIFT) {
+            fprintf(stderr, "heap of %zu bytes is larger than item refs reach, %zu at most\n", heap_size,
+                    (size_t)UINT32_MAX << ITEM_REF_MAX_SHIFT);
+            return MC_ERROR;
+        }
+    }
+    if (settings.slab_size % ((size_t)1 << item_ref_shift) != 0) {
+        fprintf(stderr, "slab size %zu is not a multiple of the %u byte item ref unit\n", settings.slab_size,
+                1U << item_ref_shift);
+        return MC_ERROR;
+    }
+    return MC_OK;
 }
 
 static rstatus_t slab_heapinfo_init(void) {
-    heapinfo.nslab = 0;
-    heapinfo.max_nslab = settings.maxbytes / settings.slab_size;
-    heapinfo.base = NULL;
+    struct slab_heapinfo *h;
+    uint32_t i, max_nslab;
+    size_t heap_size;
+    max_nslab = settings.maxbytes / settings.slab_size / nshard;
+    if (max_nslab == 0) {
+        return MC_ENOMEM;
+    }
+    heap_size = slab_heap_size();
+    heap_base = NULL;
+    heap_warm = false;
     if (settings.prealloc) {
-        heapinfo.base = malloc(heapinfo.max_nslab * settings.slab_size);
-        if (heapinfo.base == NULL) {
+        if (settings.heap_path != NULL) {
+            heap_base = slab_heap_map_file(heap_size, max_nslab);
+        } else {
+            heap_base = slab_heap_map(heap_size);
+        }
+        if (heap_base == NULL) {
+            return MC_ENOMEM;
+        }
+        if (settings.prefault_threads > 0) {
+            slab_heap_prefault(heap_base, heap_size);
+        }
+    } else {
+        heap_base = slab_heap_reserve(heap_size);
+        if (heap_base == NULL) {
             return MC_ENOMEM;
         }
     }
-    heapinfo.curr = heapinfo.base;
-    heapinfo.slab_table = malloc(sizeof(*heapinfo.slab_table) * heapinfo.max_nslab);
-    if (heapinfo.slab_table == NULL) {
-        return MC_ENOMEM;
+    for (i = 0; i < nshard; i++) {
+        h = &shards[i].heapinfo;
+        h->nslab = 0;
+        h->max_nslab = max_nslab;
+        h->base = heap_base + (size_t)i * max_nslab * settings.slab_size;
+        h->curr = h->base;
+        h->slab_table = malloc(sizeof(*h->slab_table) * h->max_nslab);
+        if (h->slab_table == NULL) {
+            return MC_ENOMEM;
+        }
+        TAILQ_INIT(&h->slab_lruq);
+        TAILQ_INIT(&h->slab_retireq);
+        TAILQ_INIT(&h->slab_freeq);
     }
-    TAILQ_INIT(&heapinfo.slab_lruq);
     return MC_OK;
 }
 
+static void slab_magazine_destroy(void *arg);
+
+static void slab_recover(void);
+static bool slab_rebalance_shard(struct shard *s);
+static bool slab_compact_shard(struct shard *s);
+static rstatus_t slab_task_start(struct slab_task *t, uint32_t ms, bool (*run)(struct shard *s));
+
+static int magazine_key_err;
+
+static void slab_magazine_key_init(void) {
+    magazine_key_err = pthread_key_create(&magazine_key, slab_magazine_destroy);
+}
+
 rstatus_t slab_init(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
     rstatus_t status;
-    slab_slabclass_init();
+    status = slab_ref_init();
+    if (status != MC_OK) {
+        return status;
+    }
+    status = slab_slabclass_init();
+    if (status != MC_OK) {
+        return status;
+    }
     status = slab_heapinfo_init();
-    return status;
+    if (status != MC_OK) {
+        return status;
+    }
+    if (heap_warm) {
+        slab_recover();
+    }
+    if (slab_task_start(&rebalance_task, settings.rebalance_ms, slab_rebalance_shard) != MC_OK ||
+        slab_task_start(&compact_task, settings.compact_ms, slab_compact_shard) != MC_OK) {
+        return MC_ERROR;
+    }
+    pthread_once(&once, slab_magazine_key_init);
+    return magazine_key_err == 0 ? MC_OK : MC_ERROR;
 }
 
-static void slab_hdr_init(struct slab *slab, uint8_t id) {
+static void slab_hdr_init(struct shard *s, struct slab *slab, uint8_t id) {
     assert(id >= SLABCLASS_MIN_ID && id <= slabclass_max_id);
     slab->magic = SLAB_MAGIC;
     slab->id = id;
-    slab->unused = 0;
+    slab->sid = s->id;
     slab->refcount = 0;
+    slab->nlive = 0;
 }
 
-static bool slab_heap_full(void) {
-    return (heapinfo.nslab >= heapinfo.max_nslab);
+static bool slab_heap_full(struct slab_heapinfo *h) {
+    return (h->nslab >= h->max_nslab);
 }
 
-static struct slab* slab_heap_alloc(void) {
+static struct slab* slab_heap_alloc(struct slab_heapinfo *h) {
     struct slab *slab;
-    if (settings.prealloc) {
-        slab = (struct slab *)heapinfo.curr;
-        heapinfo.curr += settings.slab_size;
-    } else {
-        slab = malloc(settings.slab_size);
-    }
+    slab = (struct slab *)h->curr;
+    h->curr += settings.slab_size;
     return slab;
 }
 
-static void slab_table_update(struct slab *slab) {
-    assert(heapinfo.nslab < heapinfo.max_nslab);
-    heapinfo.slab_table[heapinfo.nslab] = slab;
-    heapinfo.nslab++;
+static void slab_table_update(struct slab_heapinfo *h, struct slab *slab) {
+    assert(h->nslab < h->max_nslab);
+    h->slab_table[h->nslab] = slab;
+    h->nslab++;
 }
 
-static struct slab* slab_table_rand(void) {
+static struct slab* slab_table_rand(struct slab_heapinfo *h) {
     uint32_t rand_idx;
-    rand_idx = (uint32_t)rand() % heapinfo.nslab;
-    return heapinfo.slab_table[rand_idx];
+    rand_idx = (uint32_t)rand() % h->nslab;
+    return h->slab_table[rand_idx];
 }
 
-static struct slab* slab_lruq_head() {
-    return TAILQ_FIRST(&heapinfo.slab_lruq);
+static struct slab* slab_lruq_head(struct slab_heapinfo *h) {
+    return TAILQ_FIRST(&h->slab_lruq);
 }
 
-static void slab_lruq_append(struct slab *slab) {
-    TAILQ_INSERT_TAIL(&heapinfo.slab_lruq, slab, s_tqe);
+static void slab_lruq_append(struct slab_heapinfo *h, struct slab *slab) {
+    TAILQ_INSERT_TAIL(&h->slab_lruq, slab, s_tqe);
 }
 
-static void slab_lruq_remove(struct slab *slab) {
-    TAILQ_REMOVE(&heapinfo.slab_lruq, slab, s_tqe);
+static void slab_lruq_remove(struct slab_heapinfo *h, struct slab *slab) {
+    TAILQ_REMOVE(&h->slab_lruq, slab, s_tqe);
 }
 
-static struct slab* slab_get_new(void) {
+//a slab compaction emptied, or a fresh one from the heap
+static struct slab* slab_get_new(struct slab_heapinfo *h) {
     struct slab *slab;
-    if (slab_heap_full()) {
+    slab = TAILQ_FIRST(&h->slab_freeq);
+    if (slab != NULL) {
+        TAILQ_REMOVE(&h->slab_freeq, slab, s_tqe);
+        return slab;
+    }
+    if (slab_heap_full(h)) {
         return NULL;
     }
-    slab = slab_heap_alloc();
+    slab = slab_heap_alloc(h);
     if (slab == NULL) {
         return NULL;
     }
-    slab_table_update(slab);
+    slab_table_update(h, slab);
     return slab;
 }
 
-static void _slab_link_lruq(struct slab *slab) {
+static void _slab_link_lruq(struct slab_heapinfo *h, struct slab *slab) {
     slab->utime = time_now();
-    slab_lruq_append(slab);
+    slab_lruq_append(h, slab);
 }
 
-static void _slab_unlink_lruq(struct slab *slab) {
-    slab_lruq_remove(slab);
+static void _slab_unlink_lruq(struct slab_heapinfo *h, struct slab *slab) {
+    slab_lruq_remove(h, slab);
 }
 
-static void slab_evict_one(struct slab *slab) {
+static void slab_evict_one(struct shard *s, struct slab *slab) {
     struct slabclass *p;
+    struct slabfree *f;
     struct item *it;
     uint32_t i;
     p = &slabclass[slab->id];
-    if (p->free_item != NULL && slab == item_2_slab(p->free_item)) {
-        p->nfree_item = 0;
-        p->free_item = NULL;
+    f = &s->slabfree[slab->id];
+    if (f->free_item != NULL && slab == item_2_slab(f->free_item)) {
+        f->nfree_item = 0;
+        f->free_item = NULL;
     }
     for (i = 0; i < p->nitem; i++) {
         it = slab_2_item(slab, i, p->size);
         assert(it->magic == ITEM_MAGIC);
         assert(it->refcount == 0);
-        assert(it->offset != 0);
         if (item_is_linked(it)) {
-            item_reuse(it);
+            item_reuse(s, it);
+            item_unchain(s, it, settings.lockfree_read);
         } else if (item_is_slabbed(it)) {
             assert(slab == item_2_slab(it));
-            assert(!TAILQ_EMPTY(&p->free_itemq));
+            assert(!ITEMQ_EMPTY(&f->free_itemq));
             it->flags &= ~ITEM_SLABBED;
-            assert(p->nfree_itemq > 0);
-            p->nfree_itemq--;
-            TAILQ_REMOVE(&p->free_itemq, it, i_tqe);
+            assert(f->nfree_itemq > 0);
+            f->nfree_itemq--;
+            ITEMQ_REMOVE(&f->free_itemq, it, i_tqe);
+        } else if (item_is_retired(it)) {
+            item_unretire(s, it);
+            item_unchain(s, it, true);
         }
     }
-    slab_lruq_remove(slab);
+    s->pressure[slab->id].nslab--;
+    slab_lruq_remove(&s->heapinfo, slab);
 }
 
-static struct slab* slab_evict_rand(void) {
+//an evicted slab waits out lock free readers, pinned so it is not evicted again
+static void slab_retire(struct shard *s, struct slab *slab) {
+    slab->refcount = 1;
+    slab->utime = (int)(uint32_t)epoch_now();
+    TAILQ_INSERT_TAIL(&s->heapinfo.slab_retireq, slab, s_tqe);
+}
+
+static struct slab* slab_get_retired(struct shard *s) {
+    struct slab *slab;
+    slab = TAILQ_FIRST(&s->heapinfo.slab_retireq);
+    if (slab == NULL || epoch_widen((uint32_t)slab->utime) >= epoch_safe()) {
+        return NULL;
+    }
+    TAILQ_REMOVE(&s->heapinfo.slab_retireq, slab, s_tqe);
+    slab->refcount = 0;
+    return slab;
+}
+
+static struct slab* slab_evicted(struct shard *s, struct slab *slab) {
+    if (!settings.lockfree_read) {
+        return slab;
+    }
+    slab_retire(s, slab);
+    epoch_advance();
+    return slab_get_retired(s);
+}
+
+static struct slab* slab_evict_rand(struct shard *s) {
     struct slab *slab;
     uint32_t tries;
     tries = SLAB_RAND_MAX_TRIES;
     do {
-        slab = slab_table_rand();
+        slab = slab_table_rand(&s->heapinfo);
         tries--;
     } while (tries > 0 && slab->refcount != 0);
     if (tries == 0) {
         return NULL;
     }
-    slab_evict_one(slab);
-    return slab;
+    slab_evict_one(s, slab);
+    return slab_evicted(s, slab);
 }
 
-static struct slab* slab_evict_lru(int id) {
+static struct slab* slab_evict_lru(struct shard *s, int id) {
     struct slab *slab;
     uint32_t tries;
-    for (tries = SLAB_LRU_MAX_TRIES, slab = slab_lruq_head(); tries > 0 && slab != NULL; tries--, slab = TAILQ_NEXT(slab, s_tqe)) {
+    for (tries = SLAB_LRU_MAX_TRIES, slab = slab_lruq_head(&s->heapinfo); tries > 0 && slab != NULL; tries--, slab = TAILQ_NEXT(slab, s_tqe)) {
         if (slab->refcount == 0) {
             break;
         }
@@ -241,40 +616,60 @@ static struct slab* slab_evict_lru(int id) {
     if (tries == 0 || slab == NULL) {
         return NULL;
     }
-    slab_evict_one(slab);
-    return slab;
+    slab_evict_one(s, slab);
+    return slab_evicted(s, slab);
 }
 
-static void slab_add_one(struct slab *slab, uint8_t id) {
+static void slab_add_one(struct shard *s, struct slab *slab, uint8_t id) {
     struct slabclass *p;
+    struct slabfree *f;
     struct item *it;
-    uint32_t i, offset;
+    uint32_t i;
     p = &slabclass[id];
-    slab_hdr_init(slab, id);
-    slab_lruq_append(slab);
+    f = &s->slabfree[id];
+    slab_hdr_init(s, slab, id);
+    slab_lruq_append(&s->heapinfo, slab);
+    s->pressure[id].nslab++;
     for (i = 0; i < p->nitem; i++) {
         it = slab_2_item(slab, i, p->size);
-        offset = (uint32_t)((uint8_t *)it - (uint8_t *)slab);
-        item_hdr_init(it, offset, id);
+        item_hdr_init(it, id);
     }
-    p->nfree_item = p->nitem;
-    p->free_item = (struct item *)&slab->data[0];
+    f->nfree_item = p->nitem;
+    f->free_item = (struct item *)&slab->data[0];
 }
 
-static rstatus_t slab_get(uint8_t id) {
+static bool slab_magazine_flush(struct shard *s);
+
+static rstatus_t slab_get(struct shard *s, uint8_t id) {
     rstatus_t status;
     struct slab *slab;
-    assert(slabclass[id].free_item == NULL);
-    assert(TAILQ_EMPTY(&slabclass[id].free_itemq));
-    slab = slab_get_new();
+    assert(s->slabfree[id].free_item == NULL);
+    assert(ITEMQ_EMPTY(&s->slabfree[id].free_itemq));
+    slab = slab_get_new(&s->heapinfo);
+    if (slab == NULL && settings.lockfree_read) {
+        slab = slab_get_retired(s);
+        //a slab still waiting out readers comes next, evicting more would only retire more
+        if (slab == NULL && !TAILQ_EMPTY(&s->heapinfo.slab_retireq)) {
+            return MC_ENOMEM;
+        }
+    }
     if (slab == NULL && (settings.evict_opt & (EVICT_CS | EVICT_AS))) {
-        slab = slab_evict_lru(id);
+        slab = slab_evict_lru(s, id);
+        s->pressure[id].nevict++;
+    }
+    if (slab == NULL && (settings.evict_opt & EVICT_RS) && TAILQ_EMPTY(&s->heapinfo.slab_retireq)) {
+        slab = slab_evict_rand(s);
+        s->pressure[id].nevict++;
     }
-    if (slab == NULL && (settings.evict_opt & EVICT_RS)) {
-        slab = slab_evict_rand();
+    //magazines may be what pins every candidate slab, other threads drain theirs on their next use
+    if (slab == NULL && settings.use_magazine && (settings.evict_opt & (EVICT_CS | EVICT_AS | EVICT_RS))) {
+        __atomic_add_fetch(&s->magazine_gen, 1, __ATOMIC_RELAXED);
+        if (slab_magazine_flush(s)) {
+            return slab_get(s, id);
+        }
     }
     if (slab != NULL) {
-        slab_add_one(slab, id);
+        slab_add_one(s, slab, id);
         status = MC_OK;
     } else {
         status = MC_ENOMEM;
@@ -282,83 +677,811 @@ static rstatus_t slab_get(uint8_t id) {
     return status;
 }
 
-static struct item* slab_get_item_from_freeq(uint8_t id) {
-    struct slabclass *p;
+static struct item* slab_get_item_from_freeq(struct shard *s, uint8_t id) {
+    struct slabfree *f;
     struct item *it;
-    if (!settings.use_freeq) {
+    //magazines drain into the freeq, so it is read whenever they are on
+    if (!settings.use_freeq && !settings.use_magazine) {
         return NULL;
     }
-    p = &slabclass[id];
-    if (p->nfree_itemq == 0) {
+    f = &s->slabfree[id];
+    if (f->nfree_itemq == 0) {
         return NULL;
     }
-    it = TAILQ_FIRST(&p->free_itemq);
+    it = ITEMQ_FIRST(&f->free_itemq);
     assert(it->magic == ITEM_MAGIC);
     assert(item_is_slabbed(it));
     assert(!item_is_linked(it));
     it->flags &= ~ITEM_SLABBED;
-    assert(p->nfree_itemq > 0);
-    p->nfree_itemq--;
-    TAILQ_REMOVE(&p->free_itemq, it, i_tqe);
+    assert(f->nfree_itemq > 0);
+    f->nfree_itemq--;
+    ITEMQ_REMOVE(&f->free_itemq, it, i_tqe);
     return it;
 }
 
-static struct item* _slab_get_item(uint8_t id) {
-    struct slabclass *p;
+static struct item* slab_get_item_from_slab(struct shard *s, uint8_t id) {
+    struct slabfree *f;
     struct item *it;
-    p = &slabclass[id];
-    it = slab_get_item_from_freeq(id);
+    f = &s->slabfree[id];
+    it = f->free_item;
+    if (--f->nfree_item != 0) {
+        f->free_item = (struct item *)(((uint8_t *)f->free_item) + slabclass[id].size);
+    } else {
+        f->free_item = NULL;
+    }
+    return it;
+}
+
+static struct item* _slab_get_item(struct shard *s, uint8_t id) {
+    struct item *it;
+    it = slab_get_item_from_freeq(s, id);
     if (it != NULL) {
         return it;
     }
-    if (p->free_item == NULL && (slab_get(id) != MC_OK)) {
+    if (s->slabfree[id].free_item == NULL && (slab_get(s, id) != MC_OK)) {
         return NULL;
     }
-    it = p->free_item;
-    if (--p->nfree_item != 0) {
-        p->free_item = (struct item *)(((uint8_t *)p->free_item) + p->size);
-    } else {
-        p->free_item = NULL;
-    }
-    return it;
+    return slab_get_item_from_slab(s, id);
 }
 
-struct item* slab_get_item(uint8_t id) {
+//like _slab_get_item but never evicts, refills only take what is spare
+static struct item* slab_get_item_noevict(struct shard *s, uint8_t id) {
+    struct slab *slab;
     struct item *it;
-    assert(id >= SLABCLASS_MIN_ID && id <= slabclass_max_id);
-    it = _slab_get_item(id);
-    return it;
+    it = slab_get_item_from_freeq(s, id);
+    if (it != NULL) {
+        return it;
+    }
+    if (s->slabfree[id].free_item == NULL) {
+        slab = slab_get_new(&s->heapinfo);
+        if (slab == NULL) {
+            return NULL;
+        }
+        slab_add_one(s, slab, id);
+    }
+    return slab_get_item_from_slab(s, id);
 }
 
-static void slab_put_item_into_freeq(struct item *it) {
+
+
+static void slab_put_item_into_freeq(struct shard *s, struct item *it) {
     uint8_t id = it->id;
-    struct slabclass *p = &slabclass[id];
+    struct slabfree *f = &s->slabfree[id];
     assert(id >= SLABCLASS_MIN_ID && id <= slabclass_max_id);
     assert(item_2_slab(it)->id == id);
+    assert(item_2_slab(it)->sid == s->id);
     assert(!item_is_linked(it));
     assert(!item_is_slabbed(it));
     assert(it->refcount == 0);
-    assert(it->offset != 0);
     it->flags |= ITEM_SLABBED;
-    p->nfree_itemq++;
-    TAILQ_INSERT_HEAD(&p->free_itemq, it, i_tqe);
+    f->nfree_itemq++;
+    ITEMQ_INSERT_HEAD(&f->free_itemq, it, i_tqe);
+}
+
+static void _slab_put_item(struct shard *s, struct item *it) {
+    slab_put_item_into_freeq(s, it);
+}
+
+static void slab_recover_free(struct shard *s, struct item *it, uint8_t id) {
+    item_hdr_init(it, id);
+    slab_put_item_into_freeq(s, it);
+}
+
+static int slab_recover_cmp(const void *a, const void *b) {
+    int ta = (*(struct item * const *)a)->atime, tb = (*(struct item * const *)b)->atime;
+    return (ta > tb) - (ta < tb);
+}
+
+//oldest first so the lru queues come back in access order
+static void slab_recover_link(struct shard *s, struct item **items, size_t nitem) {
+    size_t i;
+    if (nitem == 0) {
+        return;
+    }
+    qsort(items, nitem, sizeof(*items), slab_recover_cmp);
+    for (i = 0; i < nitem; i++) {
+        if (!item_recover_chain(s, items[i]) || !item_relink(s, items[i])) {
+            item_unchain(s, items[i], false);
+            slab_recover_free(s, items[i], items[i]->id);
+        }
+    }
 }
 
-static void _slab_put_item(struct item *it) {
-    slab_put_item_into_freeq(it);
+static bool slab_recover_valid(struct shard *s, struct slab *slab) {
+    return slab->magic == SLAB_MAGIC && slab->sid == s->id &&
+           slab->id >= SLABCLASS_MIN_ID && slab->id <= slabclass_max_id;
 }
 
-void slab_put_item(struct item *it) {
-    _slab_put_item(it);
+//whether it is an item slot of class id in a slab below the recovered end of the shard
+bool slab_recovered_item(struct shard *s, struct item *it, uint8_t id) {
+    struct slab_heapinfo *h = &s->heapinfo;
+    uint8_t *p = (uint8_t *)it;
+    struct slab *slab;
+    size_t off;
+    if (p < h->base || p >= h->curr) {
+        return false;
+    }
+    slab = (struct slab *)(p - (size_t)(p - heap_base) % settings.slab_size);
+    if (slab->id != id || p < (uint8_t *)slab->data) {
+        return false;
+    }
+    off = (size_t)(p - (uint8_t *)slab->data);
+    return off % slabclass[id].size == 0 && off / slabclass[id].size < slabclass[id].nitem;
 }
 
-void slab_lruq_touch(struct slab *slab, bool allocated) {
+//walk a shard's slabs in allocation order, keep live items and free the rest
+static void *slab_recover_shard(void *arg) {
+    struct shard *s = arg;
+    struct slab_heapinfo *h = &s->heapinfo;
+    struct slabclass *p;
+    struct slab *slab;
+    struct item *it, **items = NULL, **more;
+    size_t nitem = 0, nalloc = 0;
+    uint8_t *end = h->base + (size_t)h->max_nslab * settings.slab_size, *next;
+    uint32_t i, j;
+    bool sort = true;
+    int delta = (int)(heap_started - time_started());
+    pthread_mutex_lock(&s->lock);
+    //find the end first, heads may name chunks in any slab below it
+    while (h->curr < end && slab_recover_valid(s, (struct slab *)h->curr)) {
+        slab = (struct slab *)h->curr;
+        h->curr += settings.slab_size;
+        slab->refcount = 0;
+        slab->nlive = 0;
+        if (slab->id != slabclass_max_id) {
+            continue;
+        }
+        for (i = 0; i < slabclass[slab->id].nitem; i++) {
+            it = slab_2_item(slab, i, slabclass[slab->id].size);
+            if (item_is_chunk(it) && !item_recover_chunk(it, slab->id)) {
+                it->flags = 0;
+            }
+        }
+    }
+    for (next = h->base; next < h->curr; next += settings.slab_size) {
+        slab = (struct slab *)next;
+        slab_table_update(h, slab);
+        _slab_link_lruq(h, slab);
+        s->pressure[slab->id].nslab++;
+        p = &slabclass[slab->id];
+        if (sort && nitem + p->nitem > nalloc) {
+            nalloc = (nitem + p->nitem) * 2;
+            more = realloc(items, sizeof(*items) * nalloc);
+            if (more == NULL) {
+                //no room to sort the rest, link in slab order from here on
+                slab_recover_link(s, items, nitem);
+                free(items);
+                items = NULL;
+                nitem = 0;
+                sort = false;
+            } else {
+                items = more;
+            }
+        }
+        for (i = 0; i < p->nitem; i++) {
+            it = slab_2_item(slab, i, p->size);
+            if (item_is_chunk(it)) {
+                //left for the heads to claim
+                continue;
+            }
+            if (!item_recover(s, it, slab->id, delta)) {
+                slab_recover_free(s, it, slab->id);
+            } else if (sort) {
+                items[nitem++] = it;
+            } else {
+                slab_recover_link(s, &it, 1);
+            }
+        }
+    }
+    slab_recover_link(s, items, nitem);
+    //chunks of lost heads are free slots
+    for (i = 0; i < h->nslab; i++) {
+        slab = h->slab_table[i];
+        p = &slabclass[slab->id];
+        for (j = 0; slab->id == slabclass_max_id && j < p->nitem; j++) {
+            it = slab_2_item(slab, j, p->size);
+            if (item_recover_orphan(it)) {
+                slab_recover_free(s, it, slab->id);
+            }
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    free(items);
+    return NULL;
+}
+
+//rebuild the index and queues of every shard from a reattached heap, a thread per shard
+static void slab_recover(void) {
+    pthread_t *tids;
+    uint32_t i, nthread = 0;
+    tids = malloc(sizeof(*tids) * nshard);
+    for (i = 0; i < nshard; i++) {
+        if (tids != NULL && pthread_create(&tids[nthread], NULL, slab_recover_shard, &shards[i]) == 0) {
+            nthread++;
+        } else {
+            slab_recover_shard(&shards[i]);
+        }
+    }
+    for (i = 0; i < nthread; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    free(tids);
+}
+
+static uint32_t slab_pressure(struct slabpressure *p) {
+    return p->nevict + p->nfail;
+}
+
+//the most starving class and the class that can best spare a slab for it
+static bool slab_rebalance_pick(struct shard *s, uint8_t *dst, uint8_t *src) {
+    struct slabpressure *p;
+    uint32_t hot = 0, cold = UINT32_MAX, n;
+    uint8_t id;
+    *dst = *src = SLABCLASS_INVALID_ID;
+    for (id = SLABCLASS_MIN_ID; id <= slabclass_max_id; id++) {
+        n = slab_pressure(&s->pressure[id]);
+        if (n > hot) {
+            hot = n;
+            *dst = id;
+        }
+    }
+    if (hot < SLAB_REBALANCE_MIN_PRESSURE) {
+        return false;
+    }
+    //a class keeps its last slab, or its items could never be stored again
+    for (id = SLABCLASS_MIN_ID; id <= slabclass_max_id; id++) {
+        p = &s->pressure[id];
+        n = slab_pressure(p);
+        if (id == *dst || p->nslab < 2) {
+            continue;
+        }
+        if (n < cold || (n == cold && p->nslab > s->pressure[*src].nslab)) {
+            cold = n;
+            *src = id;
+        }
+    }
+    return *src != SLABCLASS_INVALID_ID && (uint64_t)cold * SLAB_REBALANCE_RATIO <= hot;
+}
+
+//least recently used slab of a class that nothing pins
+static struct slab* slab_rebalance_victim(struct shard *s, uint8_t id) {
+    struct slab *slab;
+    for (slab = slab_lruq_head(&s->heapinfo); slab != NULL; slab = TAILQ_NEXT(slab, s_tqe)) {
+        if (slab->id == id && slab->refcount == 0) {
+            return slab;
+        }
+    }
+    return NULL;
+}
+
+static void slab_rebalance_decay(struct shard *s) {
+    uint8_t id;
+    for (id = SLABCLASS_MIN_ID; id <= slabclass_max_id; id++) {
+        s->pressure[id].nevict >>= 1;
+        s->pressure[id].nfail >>= 1;
+    }
+}
+
+//move one slab of a full shard from a class that can spare it to a starving one
+static bool slab_rebalance_shard(struct shard *s) {
+    struct slab *slab;
+    uint8_t dst, src;
+    bool moved = false;
+    pthread_mutex_lock(&s->lock);
+    if (!slab_heap_full(&s->heapinfo) || !TAILQ_EMPTY(&s->heapinfo.slab_freeq) ||
+        !slab_rebalance_pick(s, &dst, &src) ||
+        s->slabfree[dst].free_item != NULL) {
+        goto done;
+    }
+    slab = slab_rebalance_victim(s, src);
+    if (slab == NULL) {
+        goto done;
+    }
+    slab_evict_one(s, slab);
+    slab = slab_evicted(s, slab);
+    if (slab == NULL) {
+        //wait out readers of the evicted items, an allocation may take the slab meanwhile
+        pthread_mutex_unlock(&s->lock);
+        epoch_synchronize();
+        pthread_mutex_lock(&s->lock);
+        if (s->slabfree[dst].free_item == NULL) {
+            slab = slab_get_retired(s);
+        }
+    }
+    if (slab != NULL) {
+        slab_add_one(s, slab, dst);
+        moved = true;
+    }
+done:
+    slab_rebalance_decay(s);
+    pthread_mutex_unlock(&s->lock);
+    return moved;
+}
+
+//live items of a sparse slab move to free slots elsewhere in the class
+static struct slab* slab_compact_victim(struct shard *s) {
+    struct slab *slab, *victim = NULL;
+    uint32_t nitem, vnitem = 1;
+    for (slab = slab_lruq_head(&s->heapinfo); slab != NULL; slab = TAILQ_NEXT(slab, s_tqe)) {
+        nitem = slabclass[slab->id].nitem;
+        if (slab->refcount != 0 || s->pressure[slab->id].nslab < 2 ||
+            (uint64_t)slab->nlive * SLAB_COMPACT_RATIO > nitem) {
+            continue;
+        }
+        if (victim == NULL || (uint64_t)slab->nlive * vnitem < (uint64_t)victim->nlive * nitem) {
+            victim = slab;
+            vnitem = nitem;
+        }
+    }
+    return victim;
+}
+
+//free slots of a class outside one slab, the destinations compaction can use
+static uint32_t slab_compact_room(struct shard *s, struct slab *slab) {
+    struct slabfree *f = &s->slabfree[slab->id];
+    struct slabclass *p = &slabclass[slab->id];
+    uint32_t i, nroom = 0;
+    if (settings.use_freeq) {
+        nroom = f->nfree_itemq;
+        for (i = 0; i < p->nitem; i++) {
+            if (item_is_slabbed(slab_2_item(slab, i, p->size))) {
+                nroom--;
+            }
+        }
+    }
+    if (f->free_item != NULL && item_2_slab(f->free_item) != slab) {
+        nroom += f->nfree_item;
+    }
+    return nroom;
+}
+
+//empty the sparsest slab of a full shard into its class's free slots and give it up
+static bool slab_compact_shard(struct shard *s) {
+    struct slabclass *p;
+    struct slabfree *f;
+    struct slab *slab;
+    struct item *it, *nit;
+    uint32_t i;
+    bool done = false;
+    pthread_mutex_lock(&s->lock);
+    if (!slab_heap_full(&s->heapinfo) || !TAILQ_EMPTY(&s->heapinfo.slab_freeq)) {
+        goto done;
+    }
+    //dead items waiting out readers are free slots once they are safe
+    if (settings.lockfree_read) {
+        item_reclaim(s);
+    }
+    slab = slab_compact_victim(s);
+    if (slab == NULL || slab_compact_room(s, slab) < slab->nlive) {
+        goto done;
+    }
+    p = &slabclass[slab->id];
+    f = &s->slabfree[slab->id];
+    //take the slab's own free slots out of reach first, so nothing moves within it
+    if (f->free_item != NULL && item_2_slab(f->free_item) == slab) {
+        f->nfree_item = 0;
+        f->free_item = NULL;
+    }
+    for (i = 0; i < p->nitem; i++) {
+        it = slab_2_item(slab, i, p->size);
+        if (item_is_slabbed(it)) {
+            it->flags &= ~ITEM_SLABBED;
+            f->nfree_itemq--;
+            ITEMQ_REMOVE(&f->free_itemq, it, i_tqe);
+        }
+    }
+    for (i = 0; i < p->nitem && slab->nlive > 0; i++) {
+        it = slab_2_item(slab, i, p->size);
+        if (!item_is_linked(it)) {
+            continue;
+        }
+        nit = slab_get_item_noevict(s, slab->id);
+        assert(nit != NULL && item_2_slab(nit) != slab);
+        item_move(s, it, nit);
+    }
+    slab_evict_one(s, slab);
+    slab = slab_evicted(s, slab);
+    if (slab != NULL) {
+        TAILQ_INSERT_TAIL(&s->heapinfo.slab_freeq, slab, s_tqe);
+    }
+    done = true;
+done:
+    pthread_mutex_unlock(&s->lock);
+    return done;
+}
+
+static void *slab_task_thread(void *arg) {
+    struct slab_task *t = arg;
+    struct timespec ts;
+    uint32_t i;
+    ts.tv_sec = t->ms / 1000;
+    ts.tv_nsec = (long)(t->ms % 1000) * 1000000;
+    for (;;) {
+        nanosleep(&ts, NULL);
+        for (i = 0; i < nshard; i++) {
+            if (t->run(&shards[i])) {
+                __atomic_add_fetch(&t->ndone, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return NULL;
+}
+
+static rstatus_t slab_task_start(struct slab_task *t, uint32_t ms, bool (*run)(struct shard *s)) {
+    t->ms = ms;
+    t->run = run;
+    t->ndone = 0;
+    if (ms == 0) {
+        return MC_OK;
+    }
+    return pthread_create(&t->tid, NULL, slab_task_thread, t) == 0 ? MC_OK : MC_ERROR;
+}
+
+uint64_t slab_rebalance_nmoved(void) {
+    return __atomic_load_n(&rebalance_task.ndone, __ATOMIC_RELAXED);
+}
+
+uint64_t slab_compact_nslab(void) {
+    return __atomic_load_n(&compact_task.ndone, __ATOMIC_RELAXED);
+}
+
+static void slab_stat_incr(uint64_t *counter) {
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+static struct slab_magazine_set* slab_magazine_create(void) {
+    struct slab_magazine_set *set;
+    size_t nmag = (size_t)nshard * (slabclass_max_id + 1);
+    set = calloc(1, offsetof(struct slab_magazine_set, mags) + nmag * sizeof(struct slab_magazine));
+    if (set == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&magazine_lock);
+    set->next = magazine_sets;
+    magazine_sets = set;
+    pthread_mutex_unlock(&magazine_lock);
+    pthread_setspecific(magazine_key, set);
+    magazine_self = set;
+    return set;
+}
+
+static struct slab_magazine* slab_magazine(struct shard *s, uint8_t id) {
+    struct slab_magazine_set *set = magazine_self;
+    if (set == NULL && (set = slab_magazine_create()) == NULL) {
+        return NULL;
+    }
+    return &set->mags[s->id * (slabclass_max_id + 1) + id];
+}
+
+//items sitting in a magazine pin their slab so it is never evicted under them
+static void slab_magazine_drain(struct shard *s, struct slab_magazine *mag, uint32_t n) {
+    struct item *it;
+    assert(shard_locked(s));
+    while (n-- > 0 && mag->nitem > 0) {
+        it = mag->items[--mag->nitem];
+        slab_release_refcount(item_2_slab(it));
+        _slab_put_item(s, it);
+    }
+}
+
+static bool slab_magazine_flush(struct shard *s) {
+    struct slab_magazine *mag;
+    uint32_t gen = __atomic_load_n(&s->magazine_gen, __ATOMIC_RELAXED);
+    bool flushed = false;
+    uint8_t id;
+    if (magazine_self == NULL) {
+        return false;
+    }
+    for (id = SLABCLASS_MIN_ID; id <= slabclass_max_id; id++) {
+        mag = slab_magazine(s, id);
+        mag->gen = gen;
+        if (mag->nitem > 0) {
+            slab_magazine_drain(s, mag, mag->nitem);
+            flushed = true;
+        }
+    }
+    return flushed;
+}
+
+//true if a thread short of memory asked for our magazines of s since we last drained them
+static bool slab_magazine_stale(struct shard *s, struct slab_magazine *mag) {
+    return mag->gen != __atomic_load_n(&s->magazine_gen, __ATOMIC_RELAXED);
+}
+
+static void slab_magazine_refill(struct shard *s, uint8_t id, struct slab_magazine *mag) {
+    struct item *it;
+    pthread_mutex_lock(&s->lock);
+    while (mag->nitem < SLAB_MAGAZINE_BATCH && (it = slab_get_item_noevict(s, id)) != NULL) {
+        slab_acquire_refcount(item_2_slab(it));
+        mag->items[mag->nitem++] = it;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void slab_magazine_destroy(void *arg) {
+    struct slab_magazine_set *set = arg, **pset;
+    struct slab_magazine *mag;
+    uint32_t i;
+    uint8_t id;
+    for (i = 0; i < nshard; i++) {
+        for (id = SLABCLASS_MIN_ID; id <= slabclass_max_id; id++) {
+            mag = &set->mags[i * (slabclass_max_id + 1) + id];
+            if (mag->nitem == 0) {
+                continue;
+            }
+            pthread_mutex_lock(&shards[i].lock);
+            slab_magazine_drain(&shards[i], mag, mag->nitem);
+            pthread_mutex_unlock(&shards[i].lock);
+        }
+    }
+    pthread_mutex_lock(&magazine_lock);
+    for (pset = &magazine_sets; *pset != set; pset = &(*pset)->next) {
+    }
+    *pset = set->next;
+    magazine_retired.alloc_hit += set->stats.alloc_hit;
+    magazine_retired.alloc_miss += set->stats.alloc_miss;
+    magazine_retired.free_hit += set->stats.free_hit;
+    magazine_retired.free_miss += set->stats.free_miss;
+    pthread_mutex_unlock(&magazine_lock);
+    magazine_self = NULL;
+    free(set);
+}
+
+//called without the shard lock, the caller drops the slab pin once it holds it
+struct item* slab_magazine_get(struct shard *s, uint8_t id) {
+    struct slab_magazine *mag;
+    assert(id >= SLABCLASS_MIN_ID && id <= slabclass_max_id);
+    mag = slab_magazine(s, id);
+    if (mag == NULL) {
+        return NULL;
+    }
+    if (slab_magazine_stale(s, mag)) {
+        pthread_mutex_lock(&s->lock);
+        slab_magazine_flush(s);
+        pthread_mutex_unlock(&s->lock);
+    }
+    if (mag->nitem > 0) {
+        slab_stat_incr(&magazine_self->stats.alloc_hit);
+    } else {
+        slab_stat_incr(&magazine_self->stats.alloc_miss);
+        slab_magazine_refill(s, id, mag);
+        if (mag->nitem == 0) {
+            return NULL;
+        }
+    }
+    return mag->items[--mag->nitem];
+}
+
+static bool slab_magazine_put(struct shard *s, struct item *it) {
+    struct slab_magazine *mag;
+    assert(!item_is_linked(it));
+    assert(!item_is_slabbed(it));
+    assert(it->refcount == 0);
+    mag = slab_magazine(s, it->id);
+    if (mag == NULL) {
+        return false;
+    }
+    //the item goes back to the slab with the rest
+    if (slab_magazine_stale(s, mag)) {
+        slab_magazine_flush(s);
+        return false;
+    }
+    if (mag->nitem == SLAB_MAGAZINE_SIZE) {
+        slab_stat_incr(&magazine_self->stats.free_miss);
+        slab_magazine_drain(s, mag, SLAB_MAGAZINE_BATCH);
+    } else {
+        slab_stat_incr(&magazine_self->stats.free_hit);
+    }
+    slab_acquire_refcount(item_2_slab(it));
+    mag->items[mag->nitem++] = it;
+    return true;
+}
+
+static struct item* slab_get_item_from_magazine(struct shard *s, uint8_t id) {
+    struct slab_magazine *mag;
+    struct item *it;
+    if (!settings.use_magazine || magazine_self == NULL) {
+        return NULL;
+    }
+    mag = slab_magazine(s, id);
+    if (slab_magazine_stale(s, mag)) {
+        slab_magazine_flush(s);
+    }
+    if (mag->nitem == 0) {
+        return NULL;
+    }
+    it = mag->items[--mag->nitem];
+    slab_release_refcount(item_2_slab(it));
+    return it;
+}
+
+struct item* slab_get_item(struct shard *s, uint8_t id) {
+    struct item *it;
+    assert(id >= SLABCLASS_MIN_ID && id <= slabclass_max_id);
+    assert(shard_locked(s));
+    it = slab_get_item_from_magazine(s, id);
+    if (it != NULL) {
+        return it;
+    }
+    it = _slab_get_item(s, id);
+    return it;
+}
+
+void slab_put_item(struct shard *s, struct item *it) {
+    assert(shard_locked(s));
+    if (settings.use_magazine && slab_magazine_put(s, it)) {
+        return;
+    }
+    _slab_put_item(s, it);
+}
+
+void slab_magazine_stats(struct slab_magazine_stats *stats) {
+    struct slab_magazine_set *set;
+    pthread_mutex_lock(&magazine_lock);
+    *stats = magazine_retired;
+    for (set = magazine_sets; set != NULL; set = set->next) {
+        stats->alloc_hit += __atomic_load_n(&set->stats.alloc_hit, __ATOMIC_RELAXED);
+        stats->alloc_miss += __atomic_load_n(&set->stats.alloc_miss, __ATOMIC_RELAXED);
+        stats->free_hit += __atomic_load_n(&set->stats.free_hit, __ATOMIC_RELAXED);
+        stats->free_miss += __atomic_load_n(&set->stats.free_miss, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&magazine_lock);
+}
+
+void slab_lruq_touch(struct shard *s, struct slab *slab, bool allocated) {
     if (!(allocated && (settings.evict_opt & EVICT_CS)) && !(settings.evict_opt & EVICT_AS)) {
         return;
     }
     if (slab->utime >= (time_now() - SLAB_LRU_UPDATE_INTERVAL)) {
         return;
     }
-    _slab_unlink_lruq(slab);
-    _slab_link_lruq(slab);
+    _slab_unlink_lruq(&s->heapinfo, slab);
+    _slab_link_lruq(&s->heapinfo, slab);
+}
+
+//the idx-th slab a shard allocated, NULL past the last one
+struct slab *slab_by_index(struct shard *s, uint32_t idx) {
+    assert(shard_locked(s));
+    return idx < s->heapinfo.nslab ? s->heapinfo.slab_table[idx] : NULL;
+}
+
+uint32_t slab_nitem(struct slab *slab) {
+    assert(slab->magic == SLAB_MAGIC);
+    return slabclass[slab->id].nitem;
+}
+
+struct item *slab_item(struct slab *slab, uint32_t idx) {
+    assert(idx < slab_nitem(slab));
+    return slab_2_item(slab, idx, slabclass[slab->id].size);
+}
+
+void slab_profile_sample(size_t size) {
+    size_t g = slab_granule(size);
+    __atomic_add_fetch(&profile_hist[g < slab_nlookup ? g : slab_nlookup], 1, __ATOMIC_RELAXED);
+}
+
+//sampled sizes as points a class may end at, each with a count and a sum of sizes
+struct slab_profile_point {
+    size_t   size;
+    uint64_t count;
+    uint64_t sum;
+};
+
+static uint32_t slab_profile_points(struct slab_profile_point *pts) {
+    uint32_t n = 0, i, j;
+    uint64_t count;
+    struct slab_profile_point p;
+    size_t g;
+    for (g = 0; g < slab_nlookup; g++) {
+        count = __atomic_load_n(&profile_hist[g], __ATOMIC_RELAXED);
+        if (count == 0) {
+            continue;
+        }
+        //merge neighbours pairwise once full, which only removes possible class ends
+        if (n == SLAB_PROFILE_MAX_POINTS) {
+            for (i = 0, j = 0; i < n; i += 2, j++) {
+                //read both of the pair before writing, pts[j] may be pts[i]
+                p = pts[i + 1 < n ? i + 1 : i];
+                if (i + 1 < n) {
+                    p.count += pts[i].count;
+                    p.sum += pts[i].sum;
+                }
+                pts[j] = p;
+            }
+            n = j;
+        }
+        pts[n].size = (g + 1) << SLAB_GRANULE_SHIFT;
+        if (pts[n].size > slabclass[slabclass_max_id].size) {
+            pts[n].size = slabclass[slabclass_max_id].size;
+        }
+        pts[n].count = count;
+        pts[n].sum = count * pts[n].size;
+        n++;
+    }
+    //the largest class stays, or values stored today would no longer fit
+    if (n == 0 || pts[n - 1].size < slabclass[slabclass_max_id].size) {
+        if (n == SLAB_PROFILE_MAX_POINTS) {
+            n--;
+            pts[n - 1].count += pts[n].count;
+            pts[n - 1].sum += pts[n].sum;
+            pts[n - 1].size = pts[n].size;
+        }
+        pts[n].size = slabclass[slabclass_max_id].size;
+        pts[n].count = 0;
+        pts[n].sum = 0;
+        n++;
+    }
+    pts[n - 1].size = slabclass[slabclass_max_id].size;
+    return n;
+}
+
+//classes of at most nclass ids that waste the least space on the sampled sizes
+uint8_t slab_profile_propose(size_t *profile, uint8_t nclass) {
+    struct slab_profile_point *pts;
+    uint64_t *count, *sum, *prev, *cur, cost;
+    uint16_t *from;
+    uint32_t n, c, m, l, best;
+    uint8_t id;
+    if (profile_hist == NULL || nclass == 0) {
+        return 0;
+    }
+    if (nclass > SLABCLASS_MAX_ID) {
+        nclass = SLABCLASS_MAX_ID;
+    }
+    pts = malloc(sizeof(*pts) * (SLAB_PROFILE_MAX_POINTS + 1));
+    count = malloc(sizeof(*count) * (SLAB_PROFILE_MAX_POINTS + 2) * 4);
+    from = malloc(sizeof(*from) * (SLAB_PROFILE_MAX_POINTS + 2) * (nclass + 1));
+    if (pts == NULL || count == NULL || from == NULL) {
+        free(pts);
+        free(count);
+        free(from);
+        return 0;
+    }
+    n = slab_profile_points(pts);
+    sum = count + n + 1;
+    prev = sum + n + 1;
+    cur = prev + n + 1;
+    count[0] = sum[0] = 0;
+    for (m = 0; m < n; m++) {
+        count[m + 1] = count[m] + pts[m].count;
+        sum[m + 1] = sum[m] + pts[m].sum;
+    }
+    //prev[m] is the least waste of the first m points with c - 1 classes
+    for (m = 0; m <= n; m++) {
+        prev[m] = m == 0 ? 0 : UINT64_MAX;
+    }
+    best = 0;
+    for (c = 1; c <= nclass && c <= n; c++) {
+        cur[0] = UINT64_MAX;
+        for (m = 1; m <= n; m++) {
+            cur[m] = UINT64_MAX;
+            for (l = c - 1; l < m; l++) {
+                if (prev[l] == UINT64_MAX) {
+                    continue;
+                }
+                cost = prev[l] + pts[m - 1].size * (count[m] - count[l]) - (sum[m] - sum[l]);
+                if (cost < cur[m]) {
+                    cur[m] = cost;
+                    from[c * (n + 1) + m] = (uint16_t)l;
+                }
+            }
+        }
+        if (best == 0 || cur[n] < prev[n]) {
+            best = c;
+        }
+        memcpy(prev, cur, sizeof(*prev) * (n + 1));
+        //more classes never waste more, stop once nothing is left to gain
+        if (cur[n] == 0) {
+            break;
+        }
+    }
+    for (c = best, m = n; c > 0; c--) {
+        profile[c] = pts[m - 1].size;
+        m = from[c * (n + 1) + m];
+    }
+    id = (uint8_t)best;
+    free(pts);
+    free(count);
+    free(from);
+    return id;
 }
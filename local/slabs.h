@@ -14,14 +14,29 @@
 #define SLAB_RAND_MAX_TRIES 50
 #define SLAB_LRU_MAX_TRIES 50
 #define SLAB_LRU_UPDATE_INTERVAL 1
+//item sizes map to classes through a table with one entry per granule
+#define SLAB_GRANULE_SHIFT 3
+#define SLAB_PROFILE_MIN_SIZE ((size_t) 96)
+#define SLAB_PROFILE_FACTOR 1.25
+//distinct sampled sizes a proposed profile is fitted to
+#define SLAB_PROFILE_MAX_POINTS 512
+#define SLAB_MAGAZINE_SIZE 32
+#define SLAB_MAGAZINE_BATCH 16
+//decayed evictions and failed allocations before a class counts as starving
+#define SLAB_REBALANCE_MIN_PRESSURE 16
+//a victim class sees at most this fraction of the starving class's pressure
+#define SLAB_REBALANCE_RATIO 4
+//a slab is compacted only while at most this fraction of its items is live
+#define SLAB_COMPACT_RATIO 4
 
 struct slab {
     uint32_t          magic;
     uint8_t           id;
-    uint8_t           unused;
+    uint8_t           sid;
     uint16_t          refcount;
     TAILQ_ENTRY(slab) s_tqe;
     int               utime;
+    uint32_t          nlive;
     uint8_t           data[1];
 };
 
@@ -30,21 +45,72 @@ TAILQ_HEAD(slab_tqh, slab);
 struct slabclass {
     uint32_t        nitem;
     size_t          size;
+};
+
+extern uint8_t slabclass_max_id;
+
+//per shard free items of a slab class
+struct slabfree {
     uint32_t        nfree_itemq;
     struct item_tqh free_itemq;
     uint32_t        nfree_item;
     struct item     *free_item;
 };
 
+//per shard demand on a class, halved on every rebalancer pass
+struct slabpressure {
+    uint32_t nslab;
+    uint32_t nevict;
+    uint32_t nfail;
+};
+
+//per shard slab heap, a slice of the whole heap
+struct slab_heapinfo {
+    uint8_t         *base;
+    uint8_t         *curr;
+    uint32_t        nslab;
+    uint32_t        max_nslab;
+    struct slab     **slab_table;
+    struct slab_tqh slab_lruq;
+    struct slab_tqh slab_retireq;
+    struct slab_tqh slab_freeq;
+};
+
+//per thread cache of free items of one class in one shard
+struct slab_magazine {
+    uint32_t    nitem;
+    uint32_t    gen;    //magazine_gen of the shard when last drained
+    struct item *items[SLAB_MAGAZINE_SIZE];
+};
+
+struct slab_magazine_stats {
+    uint64_t alloc_hit;
+    uint64_t alloc_miss;
+    uint64_t free_hit;
+    uint64_t free_miss;
+};
+
+struct shard;
+
 size_t slab_size(void);
 void slab_acquire_refcount(struct slab *slab);
 void slab_release_refcount(struct slab *slab);
 size_t slab_item_size(uint8_t id);
 uint8_t slab_id(size_t size);
 rstatus_t slab_init(void);
-struct item *slab_get_item(uint8_t id);
-void slab_put_item(struct item *it);
-void slab_lruq_touch(struct slab *slab, bool allocated);
+struct item *slab_get_item(struct shard *s, uint8_t id);
+void slab_put_item(struct shard *s, struct item *it);
+struct item *slab_magazine_get(struct shard *s, uint8_t id);
+void slab_magazine_stats(struct slab_magazine_stats *stats);
+void slab_lruq_touch(struct shard *s, struct slab *slab, bool allocated);
+struct slab *slab_by_index(struct shard *s, uint32_t idx);
+uint32_t slab_nitem(struct slab *slab);
+bool slab_recovered_item(struct shard *s, struct item *it, uint8_t id);
+struct item *slab_item(struct slab *slab, uint32_t idx);
+uint64_t slab_rebalance_nmoved(void);
+uint64_t slab_compact_nslab(void);
+void slab_profile_sample(size_t size);
+uint8_t slab_profile_propose(size_t *profile, uint8_t nclass);
 
 #endif
 